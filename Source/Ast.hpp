@@ -1,8 +1,12 @@
 #pragma once
 
+#include <cstddef>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <utility>
 #include <variant>
+#include <vector>
 
 
 template <typename ... F>
@@ -48,10 +52,153 @@ using Variant_t = std::variant<Data_t, Add, Sub, Mul, Div, Neg>;
 struct Expr : Variant_t 
 {
     using variant::variant;
+
+    Expr(const Expr&) = default;
+    Expr(Expr&&) = default;
+    auto operator=(const Expr&) -> Expr& = default;
+    auto operator=(Expr&&) -> Expr& = default;
+
+    // Children owned by this node alone are unlinked into a local list and
+    // released one by one, so deep trees are not destroyed recursively.
+    ~Expr()
+    {
+        std::vector<std::shared_ptr<Expr>> pending;
+
+        const auto unlink = [&](Expr& e)
+        {
+            const auto take = [&](std::shared_ptr<Expr>& child)
+            {
+                if(child && child.use_count() == 1)
+                {
+                    pending.push_back(std::move(child));
+                }
+            };
+
+            std::visit(overloaded
+            {
+                [](Data_t) {},
+                [&](Neg& n) { take(n.expr); },
+                [&](auto& b) { take(b.lhs); take(b.rhs); },
+            }, static_cast<Variant_t&>(e));
+        };
+
+        unlink(*this);
+
+        while(!pending.empty())
+        {
+            const auto node = std::move(pending.back());
+            pending.pop_back();
+            unlink(*node);
+        }
+    }
 };
 
+// Children are forwarded, so temporaries are moved into their node.
+
 template <typename E>
-auto MakeExpr(auto... e)
+auto MakeExpr(auto&&... e)
+{
+    return Expr{E{std::make_shared<Expr>(std::forward<decltype(e)>(e))...}};
+}
+
+// Traversals use explicit work stacks on the heap instead of the native
+// stack; past `maxDepth` levels they throw Depth_error.
+
+inline constexpr std::size_t defaultMaxDepth = std::size_t{1} << 24;
+
+class Depth_error : public std::runtime_error
+{
+public:
+
+    explicit Depth_error(std::size_t maxDepth) 
+             : std::runtime_error{"expression nested deeper than " + std::to_string(maxDepth) + " levels"}
+    {
+    }
+};
+
+// Parsers recurse on the native stack once per parenthesis; they count
+// levels with a Nesting_guard and give up with Depth_error past maxNesting.
+
+inline thread_local std::size_t maxNesting = 1000;
+
+class Nesting_guard
 {
-    return Expr{E{std::make_shared<Expr>(e)...}};
-}
\ No newline at end of file
+public:
+
+    Nesting_guard()
+    {
+        if(++Depth() > maxNesting)
+        {
+            --Depth();
+            throw Depth_error{maxNesting};
+        }
+    }
+
+    ~Nesting_guard()
+    {
+        --Depth();
+    }
+
+    Nesting_guard(const Nesting_guard&) = delete;
+    auto operator=(const Nesting_guard&) -> Nesting_guard& = delete;
+
+private:
+
+    static auto Depth() -> std::size_t&
+    {
+        thread_local std::size_t depth{};
+        return depth;
+    }
+};
+
+// Calls visit(node, depth) on every node of `root` in post-order (lhs, rhs,
+// node). The work stack is kept per thread and reused across calls.
+
+template <typename F>
+void post_order(const Expr& root, F&& visit, std::size_t maxDepth = defaultMaxDepth)
+{
+    struct Item
+    {
+        const Expr* expr;
+        std::size_t depth;
+        bool expanded;
+    };
+
+    thread_local std::vector<Item> stack;
+    auto work = std::move(stack);
+    work.clear();
+    work.push_back({&root, 0, false});
+
+    while(!work.empty())
+    {
+        auto& top = work.back();
+        const auto [expr, depth, expanded] = top;
+
+        if(expanded || std::holds_alternative<Data_t>(*expr))
+        {
+            work.pop_back();
+            visit(*expr, depth);
+            continue;
+        }
+
+        if(depth >= maxDepth)
+        {
+            throw Depth_error{maxDepth};
+        }
+
+        top.expanded = true;
+
+        std::visit(overloaded
+        {
+            [](Data_t) {},
+            [&](const Neg& n) { work.push_back({n.expr.get(), depth + 1, false}); },
+            [&](const auto& b)
+            {
+                work.push_back({b.rhs.get(), depth + 1, false});
+                work.push_back({b.lhs.get(), depth + 1, false});
+            },
+        }, static_cast<const Variant_t&>(*expr));
+    }
+
+    stack = std::move(work);
+}
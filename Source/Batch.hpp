@@ -0,0 +1,279 @@
+#pragma once
+
+#include "Ast.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// Batch evaluation of files holding newline- or semicolon-separated
+// expressions: the input is mapped and sliced in place, results go through
+// one large output buffer.
+
+class Mapped_file
+{
+public:
+
+    // Pages behind the read position are dropped every `window` bytes, so the
+    // resident set stays bounded whatever the file size.
+    static constexpr std::size_t window = std::size_t{64} << 20;
+
+    explicit Mapped_file(const std::string& path)
+    {
+        const auto fd = ::open(path.c_str(), O_RDONLY);
+
+        if(fd < 0)
+        {
+            throw std::system_error{errno, std::generic_category(), path};
+        }
+
+        struct stat st{};
+
+        if(::fstat(fd, &st) < 0)
+        {
+            const auto error = errno;
+            ::close(fd);
+            throw std::system_error{error, std::generic_category(), path};
+        }
+
+        size = static_cast<std::size_t>(st.st_size);
+
+        int error{};
+
+        if(size > 0)
+        {
+            data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            error = errno;
+        }
+
+        ::close(fd);
+
+        if(data == MAP_FAILED)
+        {
+            throw std::system_error{error, std::generic_category(), path};
+        }
+
+        if(size > 0)
+        {
+            ::madvise(data, size, MADV_SEQUENTIAL);
+            ::madvise(data, std::min(size, window), MADV_WILLNEED);
+        }
+    }
+
+    Mapped_file(const Mapped_file&) = delete;
+    auto operator=(const Mapped_file&) -> Mapped_file& = delete;
+
+    ~Mapped_file()
+    {
+        if(size > 0)
+        {
+            ::munmap(data, size);
+        }
+    }
+
+    auto View() const -> std::string_view
+    {
+        return {static_cast<const char*>(data), size};
+    }
+
+    // Called with the current read offset: releases the consumed windows and
+    // prefetches the one being read.
+    void Consumed(std::size_t offset)
+    {
+        const auto end = offset - offset % window;
+
+        if(end <= released)
+        {
+            return;
+        }
+
+        const auto base = static_cast<char*>(data);
+        ::madvise(base + released, end - released, MADV_DONTNEED);
+        released = end;
+
+        if(released < size)
+        {
+            ::madvise(base + released, std::min(window, size - released), MADV_WILLNEED);
+        }
+    }
+
+private:
+
+    void* data{};
+    std::size_t size{};
+    std::size_t released{};
+};
+
+// Writes all of `bytes`, retrying interrupted and short writes.
+
+inline void write_all(int fd, std::string_view bytes)
+{
+    std::size_t written{};
+
+    while(written < bytes.size())
+    {
+        const auto n = ::write(fd, bytes.data() + written, bytes.size() - written);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            throw std::system_error{errno, std::generic_category(), "write"};
+        }
+
+        written += static_cast<std::size_t>(n);
+    }
+}
+
+class Buffered_writer
+{
+public:
+
+    explicit Buffered_writer(int descriptor, std::size_t capacity = std::size_t{4} << 20)
+             : fd{descriptor}
+    {
+        buffer.reserve(capacity);
+    }
+
+    // The descriptor is closed again if the buffer cannot be allocated.
+    explicit Buffered_writer(const std::string& path, std::size_t capacity = std::size_t{4} << 20)
+             : fd{Open(path)}, owned{true}
+    {
+        try
+        {
+            buffer.reserve(capacity);
+        }
+        catch(...)
+        {
+            ::close(fd);
+            throw;
+        }
+    }
+
+    Buffered_writer(const Buffered_writer&) = delete;
+    auto operator=(const Buffered_writer&) -> Buffered_writer& = delete;
+
+    // Flush first to see write errors: a destructor cannot report them.
+    ~Buffered_writer()
+    {
+        try
+        {
+            Flush();
+        }
+        catch(const std::system_error&)
+        {
+        }
+
+        if(owned)
+        {
+            ::close(fd);
+        }
+    }
+
+    void Write(std::string_view text)
+    {
+        if(buffer.size() + text.size() > buffer.capacity())
+        {
+            Flush();
+        }
+
+        buffer.insert(buffer.end(), text.begin(), text.end());
+    }
+
+    void Write(Data_t value)
+    {
+        char digits[32];
+        const auto [ptr, ec] = std::to_chars(std::begin(digits), std::end(digits), value);
+        Write(std::string_view{digits, static_cast<std::size_t>(ptr - digits)});
+    }
+
+    void Flush()
+    {
+        write_all(fd, {buffer.data(), buffer.size()});
+        buffer.clear();
+    }
+
+    // Opens `path` for writing, truncated; throws with open's error.
+    static auto Open(const std::string& path) -> int
+    {
+        const auto descriptor = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(descriptor < 0)
+        {
+            throw std::system_error{errno, std::generic_category(), path};
+        }
+
+        return descriptor;
+    }
+
+private:
+
+    int fd;
+    bool owned{};
+    std::vector<char> buffer;
+};
+
+struct Batch_stats
+{
+    std::size_t expressions{};
+    std::size_t errors{};
+    std::size_t bytes{};
+};
+
+// Evaluates every expression of `input` with `evaluate`
+// (std::string_view -> std::optional<Data_t>) and writes one result per line,
+// or "error" when evaluation fails. Blank expressions are skipped.
+
+template <typename F>
+auto run_batch(Mapped_file& input, Buffered_writer& output, F evaluate) -> Batch_stats
+{
+    constexpr std::string_view separators{"\n;"};
+    constexpr std::string_view spaces{" \t\r\v\f"};
+
+    const auto text = input.View();
+    Batch_stats stats{.bytes = text.size()};
+
+    for(std::size_t pos = 0; pos < text.size();)
+    {
+        const auto end = std::min(text.find_first_of(separators, pos), text.size());
+        const auto slice = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        if(slice.find_first_not_of(spaces) == std::string_view::npos)
+        {
+            continue;
+        }
+
+        ++stats.expressions;
+
+        if(const auto result = evaluate(slice))
+        {
+            output.Write(*result);
+        }
+        else
+        {
+            ++stats.errors;
+            output.Write("error");
+        }
+
+        output.Write("\n");
+        input.Consumed(std::min(pos, text.size()));
+    }
+
+    output.Flush();
+    return stats;
+}
@@ -0,0 +1,1461 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "Cache.hpp"
+#include "Closure.hpp"
+#include "ConstCompiler.hpp"
+#include "Container.hpp"
+#include "Eval.hpp"
+#include "FlatAst.hpp"
+#include "Jit.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "Peephole.hpp"
+#include "Rebalance.hpp"
+#include "Threaded.hpp"
+#include "Vm.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <stack>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Micro benchmarks, run with `interpreter -b`.
+
+using Seconds_t = std::chrono::duration<double>;
+
+template <typename F>
+auto measure(F&& func, std::size_t iterations = 1) -> Seconds_t
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    for(std::size_t i = 0; i < iterations; ++i)
+    {
+        func();
+    }
+
+    return Seconds_t{std::chrono::steady_clock::now() - start} / static_cast<double>(iterations);
+}
+
+inline void report(std::string_view name, std::string_view what, double value, std::string_view unit)
+{
+    std::cout << std::left << std::setw(24) << name 
+              << std::setw(24) << what 
+              << std::right << std::setw(12) << std::fixed << std::setprecision(2) << value 
+              << " " << unit << std::endl;
+}
+
+// Checks failed so far: `interpreter -b` fails when any did.
+
+inline auto failures() -> std::size_t&
+{
+    static std::size_t count{};
+    return count;
+}
+
+// `unit`, flagged and counted as a failure unless `ok`.
+inline auto checked(bool ok, std::string_view unit) -> std::string
+{
+    if(!ok)
+    {
+        ++failures();
+        return std::string{unit} + " 😟";
+    }
+
+    return std::string{unit};
+}
+
+inline void expect(bool ok, std::string_view what)
+{
+    if(!ok)
+    {
+        ++failures();
+        std::cout << "😟 " << what << std::endl;
+    }
+}
+
+// Verified up front, so that timed loops measure exec alone.
+inline auto verified(const std::vector<Chunk_t>& chunks) -> std::vector<Verified_chunk>
+{
+    std::vector<Verified_chunk> views;
+    views.reserve(chunks.size());
+
+    for(const auto& chunk : chunks)
+    {
+        views.push_back(verify(chunk));
+    }
+
+    return views;
+}
+
+// Deterministic formula generator: `terms` operands per formula, nested
+// parentheses up to `depth`.
+
+class Formula_generator
+{
+public:
+
+    explicit Formula_generator(std::uint32_t s = 42) : seed{s} {}
+
+    auto Formula(std::size_t terms, std::size_t depth = 2) -> std::string
+    {
+        std::string out;
+        Append(out, terms, depth);
+        return out;
+    }
+
+private:
+
+    auto Next() -> std::uint32_t
+    {
+        seed = seed * 1664525U + 1013904223U;
+        return seed >> 8;
+    }
+
+    void Append(std::string& out, std::size_t terms, std::size_t depth)
+    {
+        constexpr std::string_view ops[]{" + ", " - ", " * ", " / "};
+
+        for(std::size_t i = 0; i < terms; ++i)
+        {
+            if(i > 0)
+            {
+                out += ops[Next() % 4];
+            }
+
+            if(depth > 0 && Next() % 5 == 0)
+            {
+                out += "(";
+                Append(out, 2 + Next() % 3, depth - 1);
+                out += ")";
+            }
+            else if(Next() % 2 == 0)
+            {
+                out += std::to_string(1 + Next() % 999);
+            }
+            else
+            {
+                out += std::to_string(1 + Next() % 99) + "." + std::to_string(Next() % 100);
+            }
+        }
+    }
+
+    std::uint32_t seed;
+};
+
+// The formula sets the engine benchmarks share: 1000 random formulas of 8
+// to 31 terms, nested `minDepth` to `maxDepth` levels deep in turn, parsed.
+
+inline constexpr std::size_t formulaCount = 1000;
+
+inline auto random_trees(std::uint32_t seed, std::size_t minDepth, std::size_t maxDepth) -> std::vector<Expr>
+{
+    Formula_generator gen{seed};
+    std::vector<Expr> trees;
+    trees.reserve(formulaCount);
+
+    for(std::size_t i = 0; i < formulaCount; ++i)
+    {
+        trees.push_back(pratt(gen.Formula(8 + i % 24, minDepth + i % (maxDepth - minDepth + 1)))->first);
+    }
+
+    return trees;
+}
+
+inline auto compiled(const std::vector<Expr>& trees) -> std::vector<Chunk_t>
+{
+    std::vector<Chunk_t> chunks;
+    chunks.reserve(trees.size());
+
+    for(const auto& tree : trees)
+    {
+        chunks.push_back(compile(tree));
+    }
+
+    return chunks;
+}
+
+// Time of one pass of `run` (formula index -> Data_t) over `count`
+// formulas, averaged over `iterations`, and the sum of the results.
+template <typename F>
+auto time_runs(std::size_t count, F&& run, std::size_t iterations = 100) -> std::pair<Seconds_t, Data_t>
+{
+    Data_t sink{};
+    const auto t = measure([&]{ for(std::size_t i = 0; i < count; ++i) { sink += run(i); } }, iterations);
+    return {t, sink};
+}
+
+// Differential check: `engine` against `reference` (formula index ->
+// Data_t) on `count` formulas, equal bit for bit or both NaN. Prints how
+// many results differ and fails `what` when any does, unless `mayDiffer`.
+template <typename R, typename E>
+void differential(std::string_view what, std::size_t count, R&& reference, E&& engine, bool mayDiffer = false)
+{
+    std::size_t differ{};
+
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        const auto expected = reference(i), actual = engine(i);
+        const auto same = std::bit_cast<std::uint64_t>(expected) == std::bit_cast<std::uint64_t>(actual)
+                       || (std::isnan(expected) && std::isnan(actual));
+        differ += same ? 0U : 1U;
+    }
+
+    std::cout << "    results differing " << differ << std::endl;
+    expect(differ == 0 || mayDiffer, what);
+}
+
+inline void benchParsers()
+{
+    Formula_generator gen;
+    std::vector<std::string> feed;
+    std::size_t bytes{};
+
+    for(std::size_t i = 0; i < 2000; ++i)
+    {
+        feed.push_back(gen.Formula(8 + i % 16));
+        bytes += feed.back().size();
+    }
+
+    const auto throughput = [&](std::string_view name, auto parser)
+    {
+        std::size_t parsed{};
+
+        const auto t = measure([&]
+        {
+            for(const auto& f : feed)
+            {
+                parsed += parser(f).has_value();
+            }
+        }, 5);
+
+        report("parse", name, static_cast<double>(bytes) / t.count() / 1e6, "MB/s");
+        return parsed;
+    };
+
+    Tokens_t tokens;
+    std::size_t count{};
+
+    const auto t = measure([&]
+    {
+        for(const auto& f : feed)
+        {
+            lex(f, tokens);
+            count += tokens.size();
+        }
+    }, 5);
+
+    report("lex", "tokens", static_cast<double>(bytes) / t.count() / 1e6, "MB/s");
+
+    const auto c = throughput("combinators", expression);
+    const auto p = throughput("pratt", [](std::string_view f) { return pratt(f); });
+
+    if(c != p)
+    {
+        ++failures();
+        std::cout << "😟 parsers disagree: " << c << " vs " << p << std::endl;
+    }
+}
+
+// many/repeat fold in place: a million matches must stay linear. Timing
+// only, the results are checked by testRepetition (-s).
+
+inline void benchRepetition()
+{
+    constexpr std::size_t items = 1'000'000;
+
+    const auto chars = std::string(items, 'a');
+    const auto digits = std::string(items, '7');
+    
+    auto sum = std::string{"1"};
+    for(std::size_t i = 1; i < 10'000; ++i)
+    {
+        sum += "+1";
+    }
+
+    const auto rate = [](std::string_view name, Seconds_t t, std::size_t n)
+    {
+        report("repeat", name, static_cast<double>(n) / t.count() / 1e6, "M items/s");
+    };
+
+    std::size_t parsed{};
+    rate("many", measure([&]{ parsed += many(symbol('a'))(chars).has_value(); }), items);
+    rate("repeat", measure([&]{ parsed += repeat(digit)(digits).has_value(); }), items);
+    rate("some", measure([&]{ parsed += some(digit)(digits).has_value(); }), items);
+    rate("10k-term sum", measure([&]{ parsed += expression(sum).has_value(); }), 10'000);
+}
+
+// Unbalanced parentheses make every level of the plain grammar parse its
+// contents twice; memoized rules parse each offset once.
+
+inline void benchPackrat()
+{
+    const auto nested = [](std::size_t depth) { return std::string(depth, '(') + "1"; };
+
+    for(const auto depth : {10U, 16U})
+    {
+        const auto input = nested(depth);
+        const auto t = measure([&]{ expression(input); });
+        report("packrat", "plain, depth " + std::to_string(depth), t.count() * 1e6, "µs");
+    }
+
+    for(const auto depth : {10U, 16U, 1000U})
+    {
+        const auto input = nested(depth);
+        Memo_stats stats;
+        const auto t = measure([&]{ packrat(input, &stats); }, 10);
+        report("packrat", "memo, depth " + std::to_string(depth), t.count() * 1e6, "µs");
+        std::cout << "    hits " << stats.hits << ", misses " << stats.misses << std::endl;
+    }
+}
+
+// Embedded formula: parse + compile + run at startup, or compiled by the
+// compiler into a static array.
+
+inline void benchStatic()
+{
+    constexpr std::string_view source{"(12.5 + 3) * -4 / (2 - 0.25) + 7 * 3"};
+    constexpr auto folded = compile_expr<"(12.5 + 3) * -4 / (2 - 0.25) + 7 * 3">();
+    constexpr auto full = compile_expr<"(12.5 + 3) * -4 / (2 - 0.25) + 7 * 3", Fold::None>();
+
+    constexpr std::size_t iterations = 100'000;
+    Data_t sink{};
+
+    auto t = measure([&]{ sink += exec(compile(expression(source)->first)); }, iterations);
+    report("static", "parse + compile + exec", t.count() * 1e9, "ns");
+
+    const auto fullChunk = verify(full.View());
+    const auto foldedChunk = verify(folded.View());
+
+    t = measure([&]{ sink += exec(fullChunk); }, iterations);
+    report("static", "consteval, exec", t.count() * 1e9, "ns");
+
+    t = measure([&]{ sink += exec(foldedChunk); }, iterations);
+    report("static", "consteval folded, exec", t.count() * 1e9, "ns");
+
+    if(exec(full.View()) != folded.value || exec(compile(expression(source)->first)) != folded.value)
+    {
+        ++failures();
+        std::cout << "😟 consteval result differs: " << folded.value << std::endl;
+    }
+}
+
+// shared_ptr tree against the arena AST: density, parse, eval, compile.
+
+inline void benchFlat()
+{
+    Formula_generator gen;
+    std::vector<std::string> feed;
+
+    for(std::size_t i = 0; i < 2000; ++i)
+    {
+        feed.push_back(gen.Formula(16 + i % 32, 3));
+    }
+
+    std::vector<Expr> trees;
+    std::vector<Flat_ast> arenas(feed.size());
+    std::size_t nodes{};
+
+    auto t = measure([&]
+    {
+        trees.clear();
+
+        for(const auto& f : feed)
+        {
+            trees.push_back(pratt(f)->first);
+        }
+    });
+    report("ast", "parse, tree", t.count() * 1e3, "ms");
+
+    t = measure([&]
+    {
+        for(std::size_t i = 0; i < feed.size(); ++i)
+        {
+            pratt(feed[i], arenas[i]);
+        }
+    });
+    report("ast", "parse, arena", t.count() * 1e3, "ms");
+
+    for(const auto& a : arenas)
+    {
+        nodes += a.Size();
+    }
+
+    // make_shared: node + control block (two counts and a vtable pointer)
+    const auto treeBytes = static_cast<double>(sizeof(Expr) + 2 * sizeof(long) + sizeof(void*));
+    const auto arenaBytes = static_cast<double>(sizeof(Node_op) + 2 * sizeof(Node_t));
+    report("ast", "nodes / line, tree", 64.0 / treeBytes, "nodes");
+    report("ast", "nodes / line, arena", 64.0 / arenaBytes, "nodes");
+    report("ast", "opcodes / line, arena", 64.0 / sizeof(Node_op), "nodes");
+
+    Data_t treeSum{}, arenaSum{};
+
+    t = measure([&]{ for(const auto& e : trees) { treeSum += eval(e); } }, 10);
+    report("ast", "eval, tree", t.count() * 1e9 / static_cast<double>(nodes), "ns/node");
+
+    t = measure([&]{ for(const auto& a : arenas) { arenaSum += eval(a); } }, 10);
+    report("ast", "eval, arena", t.count() * 1e9 / static_cast<double>(nodes), "ns/node");
+
+    std::size_t bytes{};
+
+    t = measure([&]{ for(const auto& e : trees) { bytes += compile(e).Bytes(); } }, 10);
+    report("ast", "compile, tree", t.count() * 1e9 / static_cast<double>(nodes), "ns/node");
+
+    t = measure([&]{ for(const auto& a : arenas) { bytes -= compile(a).Bytes(); } }, 10);
+    report("ast", "compile, arena", t.count() * 1e9 / static_cast<double>(nodes), "ns/node");
+
+    if(treeSum != arenaSum || bytes != 0)
+    {
+        ++failures();
+        std::cout << "😟 tree and arena disagree" << std::endl;
+    }
+}
+
+// Machine-generated formulas repeating a few subtrees, with and without
+// hash-consing and common subexpression elimination.
+
+inline void benchCse()
+{
+    Formula_generator gen{7};
+    std::vector<std::string> pool;
+
+    for(std::size_t i = 0; i < 8; ++i)
+    {
+        auto& sub = pool.emplace_back("(");
+        sub += gen.Formula(6, 1);
+        sub += ")";
+    }
+
+    std::string formula = pool[0];
+
+    for(std::size_t i = 1; i < 400; ++i)
+    {
+        formula += i % 3 == 0 ? " * " : " + ";
+        formula += pool[(i * 7) % pool.size()];
+    }
+
+    const auto tree = pratt(formula)->first;
+    const auto plain = compile(tree);
+
+    Flat_ast dag;
+    Hash_consing consing{dag};
+    flatten(tree, consing);
+    const auto shared = compile_cse(dag);
+
+    report("cse", "nodes, tree", static_cast<double>(consing.Requested()), "");
+    report("cse", "nodes, hash-consed", static_cast<double>(dag.Size()), "");
+    report("cse", "dedup ratio", static_cast<double>(consing.Requested()) / dag.Size(), "x");
+    report("cse", "instructions, tree", static_cast<double>(count_instructions(plain.code)), "");
+    report("cse", "instructions, cse", static_cast<double>(count_instructions(shared.code)), "");
+
+    const auto plainChunk = verify(plain);
+    const auto sharedChunk = verify(shared);
+
+    auto t = measure([&]{ exec(plainChunk); }, 1000);
+    report("cse", "exec, tree", t.count() * 1e6, "µs");
+
+    t = measure([&]{ exec(sharedChunk); }, 1000);
+    report("cse", "exec, cse", t.count() * 1e6, "µs");
+
+    const auto expected = eval(tree);
+
+    if(exec(shared) != expected || Vm{shared}.Execute() != expected || eval(dag) != expected)
+    {
+        ++failures();
+        std::cout << "😟 cse result differs" << std::endl;
+    }
+}
+
+// The previous, natively recursive tree walker, as a reference.
+
+inline auto recursiveEval(const Expr& ast) -> Data_t
+{
+    return std::visit(overloaded
+    {
+        [](Data_t value) { return value; },
+        [](const Neg& n) { return -recursiveEval(*n.expr); },
+        [](const Mul& m) { return recursiveEval(*m.lhs) * recursiveEval(*m.rhs); },
+        [](const Div& m) { return recursiveEval(*m.lhs) / recursiveEval(*m.rhs); },
+        [](const Add& m) { return recursiveEval(*m.lhs) + recursiveEval(*m.rhs); },
+        [](const Sub& m) { return recursiveEval(*m.lhs) - recursiveEval(*m.rhs); },
+    }, static_cast<const Variant_t&>(ast));
+}
+
+// Bounded and explicit-stack walkers on normal inputs against the recursive
+// one, then pathological depths that used to overflow the native stack.
+
+inline void benchTraversal()
+{
+    Formula_generator gen{3};
+    std::vector<Expr> trees;
+    std::size_t nodes{};
+
+    for(std::size_t i = 0; i < 2000; ++i)
+    {
+        trees.push_back(pratt(gen.Formula(16 + i % 32, 3))->first);
+        nodes += getDepth(trees.back()) > 0 ? count_instructions(compile(trees.back()).code) - 1 : 1;
+    }
+
+    Data_t recursive{}, bounded{}, iterative{};
+
+    // Warm the trees into cache so the first measurement is not penalised.
+    measure([&]{ for(const auto& e : trees) { recursive += recursiveEval(e); } }, 3);
+    recursive = {};
+
+    auto t = measure([&]{ for(const auto& e : trees) { recursive += recursiveEval(e); } }, 10);
+    report("traversal", "eval, recursive", t.count() * 1e9 / static_cast<double>(nodes), "ns/node");
+
+    t = measure([&]{ for(const auto& e : trees) { bounded += eval(e); } }, 10);
+    report("traversal", "eval, bounded native", t.count() * 1e9 / static_cast<double>(nodes), "ns/node");
+
+    t = measure([&]{ for(const auto& e : trees) { iterative += evalStack(e); } }, 10);
+    report("traversal", "eval, explicit stack", t.count() * 1e9 / static_cast<double>(nodes), "ns/node");
+
+    if(recursive != bounded || recursive != iterative)
+    {
+        ++failures();
+        std::cout << "😟 iterative eval differs" << std::endl;
+    }
+
+    const auto negations = std::string(200'000, '-') + "5";
+    std::string nested(100'000, '(');
+    nested += "1";
+    nested += std::string(100'000, ')');
+
+    bool ok{};
+
+    t = measure([&]
+    {
+        const auto parsed = expression(negations);
+        ok = parsed && eval(parsed->first) == 5 && exec(compile(parsed->first)) == 5 && getDepth(parsed->first) == 200'000;
+    });
+    report("traversal", "200k negations", t.count() * 1e3, checked(ok, "ms"));
+
+    try
+    {
+        pratt(nested);
+        ok = false;
+    }
+    catch(const Depth_error&)
+    {
+        ok = true;
+    }
+
+    report("traversal", "100k parentheses", 0, checked(ok, "Depth_error"));
+}
+
+// Long operator chains, left-deep as parsed and after tree-height reduction:
+// the balanced trees expose independent operations to the CPU.
+
+inline void benchRebalance()
+{
+    for(const auto& [name, op] : {std::pair{"add", " + "}, std::pair{"sub", " - "}, std::pair{"mul", " * "}})
+    {
+        std::string formula = "1.5";
+
+        for(std::size_t i = 1; i < 1000; ++i)
+        {
+            formula += op;
+            formula += op[1] == '*' ? (i % 2 == 0 ? "1.001" : "0.999") : std::to_string(i % 97 + 1) + ".25";
+        }
+
+        const auto tree = pratt(formula)->first;
+        const auto balanced = rebalance(tree);
+        const auto chunk = compile(tree);
+        const auto balancedChunk = compile(balanced);
+
+        Flat_ast flat, balancedFlat;
+        flatten(tree, flat);
+        flatten(balanced, balancedFlat);
+
+        const auto label = std::string{name} + ", ";
+
+        report("rebalance", label + "depth", static_cast<double>(getDepth(tree)), "");
+        report("rebalance", label + "depth balanced", static_cast<double>(getDepth(balanced)), "");
+
+        Data_t sink{};
+
+        auto t = measure([&]{ sink += eval(tree); }, 2000);
+        report("rebalance", label + "eval", t.count() * 1e6, "µs");
+
+        t = measure([&]{ sink += eval(balanced); }, 2000);
+        report("rebalance", label + "eval balanced", t.count() * 1e6, "µs");
+
+        t = measure([&]{ sink += eval(flat); }, 2000);
+        report("rebalance", label + "flat eval", t.count() * 1e6, "µs");
+
+        t = measure([&]{ sink += eval(balancedFlat); }, 2000);
+        report("rebalance", label + "flat eval balanced", t.count() * 1e6, "µs");
+
+        const auto verifiedChunk = verify(chunk);
+        const auto verifiedBalanced = verify(balancedChunk);
+
+        t = measure([&]{ sink += exec(verifiedChunk); }, 2000);
+        report("rebalance", label + "exec", t.count() * 1e6, "µs");
+
+        t = measure([&]{ sink += exec(verifiedBalanced); }, 2000);
+        report("rebalance", label + "exec balanced", t.count() * 1e6, "µs");
+
+        const auto expected = eval(tree);
+        const auto error = std::abs(eval(balanced) - expected) / std::abs(expected);
+
+        if(error > 1e-12 || sink == 0)
+        {
+            ++failures();
+            std::cout << "😟 rebalanced " << name << " differs by " << error << std::endl;
+        }
+    }
+}
+
+// The previous compiler, copying the chunk at every node, as a reference.
+
+inline auto copyingCompile(const Expr& ast, const Chunk_t& c) -> Chunk_t
+{
+    auto newChunk = c;
+
+    const auto append = [&](auto&& emit)
+    {
+        Chunk_builder builder{0, newChunk};
+        emit(builder);
+        return builder.Take();
+    };
+
+    const auto binary = [&](const auto& e, std::byte code)
+    {
+        newChunk = copyingCompile(*e.rhs, copyingCompile(*e.lhs, newChunk));
+        return append([&](auto& b) { b.Emit(code); });
+    };
+
+    return std::visit(overloaded
+    {
+        [&](Data_t value) { return append([&](auto& b) { b.Push(value); }); },
+        [&](const Neg& e) { newChunk = copyingCompile(*e.expr, newChunk); return append([&](auto& b) { b.Emit(OpCode::Neg); }); },
+        [&](const Add& e) { return binary(e, OpCode::Add); },
+        [&](const Sub& e) { return binary(e, OpCode::Sub); },
+        [&](const Mul& e) { return binary(e, OpCode::Mul); },
+        [&](const Div& e) { return binary(e, OpCode::Div); },
+    }, static_cast<const Variant_t&>(ast));
+}
+
+// Compile time per node from a thousand to millions of nodes: the builder
+// stays flat, the copying compiler grows with the size of the chunk.
+
+inline void benchCompile()
+{
+    Formula_generator gen{11};
+
+    for(std::size_t terms = 1000; terms <= 4'000'000; terms *= 4)
+    {
+        const auto tree = pratt(gen.Formula(terms, 2))->first;
+        const auto nodes = static_cast<double>(count_instructions(compile(tree).code) - 1);
+        const auto label = std::to_string(static_cast<std::size_t>(nodes / 1000)) + "k nodes";
+
+        Chunk_t chunk;
+        const auto iterations = std::max<std::size_t>(1, 1'000'000 / terms);
+
+        auto t = measure([&]{ chunk = compile(tree); }, iterations);
+        report("compile, builder", label, t.count() * 1e9 / nodes, "ns/node");
+
+        t = measure([&]{ chunk = compile(tree, chunk.code.size()); }, iterations);
+        report("compile, reserved", label, t.count() * 1e9 / nodes, "ns/node");
+
+        if(terms <= 4'000)
+        {
+            Chunk_t copied;
+            t = measure([&]{ copied = Chunk_builder{0, copyingCompile(tree, {})}.Finish(); });
+            report("compile, copying", label, t.count() * 1e9 / nodes, checked(copied == chunk, "ns/node"));
+        }
+    }
+}
+
+// Resident size of a thousand compiled formulas against the two previous
+// encodings: doubles inlined after every Push (9 bytes a push), and a vector
+// of variants (24 bytes an instruction).
+
+inline void benchEncoding()
+{
+    const auto chunks = compiled(random_trees(5, 2, 2));
+    std::size_t bytes{}, inlined{}, instructions{};
+
+    for(const auto& chunk : chunks)
+    {
+        bytes += chunk.Bytes();
+
+        for(std::size_t pos = 0; pos < chunk.code.size();)
+        {
+            const auto op = decode(chunk, pos);
+            
+            inlined += is_push(op.code) ? 1 + sizeof(Data_t) : 1;
+            instructions += 1;
+            pos += op.size;
+        }
+    }
+
+    report("encoding", "inlined doubles", static_cast<double>(inlined) / 1000.0, "B/formula");
+    report("encoding", "variant vector", static_cast<double>(instructions * 3 * sizeof(Data_t)) / 1000.0, "B/formula");
+    report("encoding", "compact + pool", static_cast<double>(bytes) / 1000.0, "B/formula");
+
+    const auto views = verified(chunks);
+    const auto [t, sink] = time_runs(views.size(), [&](std::size_t i) { return exec(views[i]); });
+    report("encoding", "exec", t.count() * 1e9 / static_cast<double>(instructions), checked(sink != 0, "ns/instr"));
+}
+
+// Peephole passes on random formulas: instruction counts, rewrites and exec
+// time. Every formula is constant, so Fold reduces them to a single push;
+// "contract" (Local + Contract) shows the other rewrites on their own.
+
+inline void benchPeephole()
+{
+    const auto chunks = compiled(random_trees(13, 2, 2));
+
+    const std::pair<const char*, unsigned> configurations[]
+    {
+        {"-O0", 0U},
+        {"-O1", optimizationLevels[1]},
+        {"-O2", optimizationLevels[2]},
+        {"contract", Peephole::Local | Peephole::Contract},
+    };
+
+    for(const auto& [name, passes] : configurations)
+    {
+        Peephole_stats total, stats;
+        std::vector<Chunk_t> optimized;
+
+        for(const auto& chunk : chunks)
+        {
+            optimized.push_back(optimize(chunk, passes, &stats));
+
+            total.before += stats.before;
+            total.after += stats.after;
+            total.folded += stats.folded;
+            total.negations += stats.negations;
+            total.reciprocals += stats.reciprocals;
+            total.immediates += stats.immediates;
+            total.fused += stats.fused;
+        }
+
+        const auto views = verified(optimized);
+        const auto t = time_runs(views.size(), [&](std::size_t i) { return exec(views[i]); }).first;
+
+        const auto label = std::string{name} + ", ";
+        report("peephole", label + "instructions", static_cast<double>(total.after) / static_cast<double>(total.before) * 100.0, "%");
+        report("peephole", label + "exec", t.count() * 1e9 / static_cast<double>(chunks.size()), "ns/formula");
+        std::cout << "    folded " << total.folded << ", negations " << total.negations << ", reciprocals " << total.reciprocals
+                  << ", immediates " << total.immediates << ", fused " << total.fused << std::endl;
+        differential("peephole changed results", chunks.size(), [&](std::size_t i) { return exec(chunks[i]); },
+                     [&](std::size_t i) { return exec(views[i]); }, (passes & Peephole::Contract) != 0);
+    }
+}
+
+// The previous exec, on a std::stack (a std::deque), as a reference.
+
+inline auto dequeExec(Chunk_view c) -> Data_t
+{
+    std::stack<Data_t> stack;
+    std::vector<Data_t> slots;
+
+    const auto* const code = c.code.data();
+
+    const auto pop2 = [&]
+    {
+        const auto rhs = stack.top();
+        stack.pop();
+        const auto lhs = stack.top();
+        stack.pop();
+        return std::pair{lhs, rhs};
+    };
+
+    for(std::size_t pos = 0; pos < c.code.size(); ++pos)
+    {
+        const auto op = static_cast<std::byte>(code[pos]);
+
+        switch(op)
+        {
+            case OpCode::PushConst8:
+            {
+                stack.push(c.constants[read_operand<std::uint8_t>(code + pos + 1)]);
+                pos += sizeof(std::uint8_t);
+                break;
+            }
+
+            case OpCode::PushConst16:
+            {
+                stack.push(c.constants[read_operand<std::uint16_t>(code + pos + 1)]);
+                pos += sizeof(std::uint16_t);
+                break;
+            }
+
+            case OpCode::PushConst32:
+            {
+                stack.push(c.constants[read_operand<std::uint32_t>(code + pos + 1)]);
+                pos += sizeof(std::uint32_t);
+                break;
+            }
+
+            case OpCode::PushInt8:
+            {
+                stack.push(read_operand<std::int8_t>(code + pos + 1));
+                pos += sizeof(std::int8_t);
+                break;
+            }
+
+            case OpCode::PushInt16:
+            {
+                stack.push(read_operand<std::int16_t>(code + pos + 1));
+                pos += sizeof(std::int16_t);
+                break;
+            }
+
+            case OpCode::AddImm:
+            {
+                const auto operand = stack.top();
+                stack.pop();
+                stack.push(operand + c.constants[read_operand<std::uint16_t>(code + pos + 1)]);
+                pos += sizeof(std::uint16_t);
+                break;
+            }
+
+            case OpCode::Fma:
+            {
+                const auto addend = stack.top();
+                stack.pop();
+                const auto operands = pop2();
+                stack.push(std::fma(operands.first, operands.second, addend));
+                break;
+            }
+
+            case OpCode::PushZero: stack.push(0.0); break;
+            case OpCode::PushOne: stack.push(1.0); break;
+            case OpCode::PushMinusOne: stack.push(-1.0); break;
+
+            case OpCode::Neg:
+            {
+                const auto operand = stack.top();
+                stack.pop();
+                stack.push(-operand);
+                break;
+            }
+
+            case OpCode::Add:
+            {
+                const auto operands = pop2();
+                stack.push(operands.first + operands.second);
+                break;
+            }
+
+            case OpCode::Sub:
+            {
+                const auto operands = pop2();
+                stack.push(operands.first - operands.second);
+                break;
+            }
+
+            case OpCode::Div:
+            {
+                const auto operands = pop2();
+                stack.push(operands.first / operands.second);
+                break;
+            }
+
+            case OpCode::Mul:
+            {
+
+                const auto operands = pop2();
+                stack.push(operands.first * operands.second);
+                break;
+            }
+
+            case OpCode::Store:
+            {
+                const auto s = read_operand<Slot_t>(code + pos + 1);
+
+                if(s >= slots.size())
+                {
+                    slots.resize(s + 1);
+                }
+
+                slots[s] = stack.top();
+                pos += sizeof(Slot_t);
+                break;
+            }
+
+            case OpCode::Load:
+            {
+                stack.push(slots[read_operand<Slot_t>(code + pos + 1)]);
+                pos += sizeof(Slot_t);
+                break;
+            }
+
+            case OpCode::Return: return stack.top();
+            default:break;
+        }
+    }
+
+    return {};
+}
+
+// exec on the deque-backed stack against the pre-sized one, on random
+// formulas that fit the inline storage and on right-nested ones,
+// `1 - (2 - (3 - …))`, deep enough to allocate.
+
+inline void benchStack()
+{
+    const auto nested = [](std::size_t terms)
+    {
+        std::string out;
+
+        for(std::size_t i = 1; i < terms; ++i)
+        {
+            out += std::to_string(i) + " - (";
+        }
+
+        return out + std::to_string(terms) + std::string(terms - 1, ')');
+    };
+
+    std::vector<Expr> nestedTrees;
+
+    for(std::size_t i = 0; i < formulaCount; ++i)
+    {
+        nestedTrees.push_back(pratt(nested(24 + i % 40))->first);
+    }
+
+    for(const auto isNested : {false, true})
+    {
+        const auto chunks = compiled(isNested ? nestedTrees : random_trees(23, 2, 2));
+        std::size_t instructions{}, maxDepth{}, inlined{};
+
+        for(const auto& chunk : chunks)
+        {
+            instructions += count_instructions(chunk.code);
+            maxDepth = std::max(maxDepth, chunk.depth);
+            inlined += chunk.depth < Value_stack::inlineDepth ? 1U : 0U;
+        }
+
+        const std::string label = isNested ? "nested, " : "random, ";
+        const auto views = verified(chunks);
+        const auto deque = [&](std::size_t i) { return dequeExec(chunks[i]); };
+        const auto presized = [&](std::size_t i) { return exec(views[i]); };
+
+        const auto t = time_runs(chunks.size(), deque).first;
+        report("stack", label + "std::stack", t.count() * 1e9 / static_cast<double>(instructions), "ns/instr");
+
+        const auto [u, sink] = time_runs(chunks.size(), presized);
+        report("stack", label + "pre-sized", u.count() * 1e9 / static_cast<double>(instructions), checked(sink != 0, "ns/instr"));
+        std::cout << "    max depth " << maxDepth << ", inline " << inlined << "/" << chunks.size() << std::endl;
+        differential("pre-sized stack results differ", chunks.size(), deque, presized);
+    }
+}
+
+// The stack and register VMs on the same formulas: dispatches, values read
+// and written (stack cells or registers, and pool constants), code size and
+// time per formula.
+
+inline void benchRegisters()
+{
+    const auto trees = random_trees(29, 1, 4);
+    const auto chunks = compiled(trees);
+    std::vector<RegVm> regVms;
+    std::size_t dispatches{}, regDispatches{}, traffic{}, regTraffic{}, bytes{}, regBytes{}, registers{};
+
+    for(std::size_t i = 0; i < chunks.size(); ++i)
+    {
+        const auto& chunk = chunks[i];
+        const auto regChunk = compile_registers(trees[i]);
+
+        for(std::size_t pos = 0; pos < chunk.code.size();)
+        {
+            const auto op = decode(chunk, pos);
+            pos += op.size;
+
+            // Pushes write a cell (and read the pool), Neg and Return read one, operators read two.
+            traffic += is_push(op.code) ? (op.code == OpCode::PushConst8 || op.code == OpCode::PushConst16 || op.code == OpCode::PushConst32 ? 2U : 1U)
+                     : op.code == OpCode::Neg ? 2U
+                     : op.code == OpCode::Return ? 1U
+                     : 3U;
+        }
+
+        for(const auto& instruction : regChunk.code)
+        {
+            regTraffic += instruction.op == Reg_op::Return ? 1U : instruction.op == Reg_op::Neg || instruction.op == Reg_op::LoadK ? 2U : 3U;
+        }
+
+        dispatches += count_instructions(chunk.code);
+        regDispatches += regChunk.code.size();
+        bytes += chunk.Bytes();
+        regBytes += regChunk.Bytes();
+        registers += regChunk.registers;
+        regVms.emplace_back(regChunk);
+    }
+
+    const auto perFormula = [&](std::size_t n) { return static_cast<double>(n) / static_cast<double>(chunks.size()); };
+
+    report("registers", "stack, dispatches", perFormula(dispatches), "/formula");
+    report("registers", "register, dispatches", perFormula(regDispatches), "/formula");
+    report("registers", "stack, values moved", perFormula(traffic), "/formula");
+    report("registers", "register, values moved", perFormula(regTraffic), "/formula");
+    report("registers", "stack, size", perFormula(bytes), "B/formula");
+    report("registers", "register, size", perFormula(regBytes), "B/formula");
+
+    const auto views = verified(chunks);
+    const auto stack = [&](std::size_t i) { return exec(views[i]); };
+    const auto regs = [&](std::size_t i) { return regVms[i].Execute(); };
+
+    const auto t = time_runs(chunks.size(), stack).first;
+    report("registers", "stack, exec", t.count() * 1e9 / static_cast<double>(chunks.size()), "ns/formula");
+
+    const auto [u, sink] = time_runs(chunks.size(), regs);
+    report("registers", "register, exec", u.count() * 1e9 / static_cast<double>(chunks.size()), checked(sink != 0, "ns/formula"));
+    std::cout << "    registers " << perFormula(registers) << "/formula" << std::endl;
+    differential("register results differ", chunks.size(), stack, regs);
+}
+
+// Verifying compiled chunks, per instruction, and the same chunks damaged:
+// truncated by a byte, missing their first instruction, or starting with an
+// invalid opcode. Every damaged chunk must be rejected.
+
+inline void benchVerify()
+{
+    auto chunks = compiled(random_trees(41, 2, 2));
+    std::size_t instructions{}, rejected{}, accepted{};
+
+    for(std::size_t i = 0; i < chunks.size(); ++i)
+    {
+        if(i % 2 != 0)
+        {
+            chunks[i] = optimize(chunks[i], optimizationLevels[3]);
+        }
+
+        instructions += count_instructions(chunks[i].code);
+    }
+
+    const auto t = measure([&]{ for(const auto& c : chunks) { verify(c); } }, 100);
+    report("verify", "compiled chunks", t.count() * 1e9 / static_cast<double>(instructions), "ns/instr");
+
+    const auto isValid = [](const Chunk_t& c)
+    {
+        try
+        {
+            verify(c);
+            return true;
+        }
+        catch(const Bytecode_error&)
+        {
+            return false;
+        }
+    };
+
+    for(std::size_t i = 0; i < chunks.size(); ++i)
+    {
+        auto truncated = chunks[i];
+        truncated.code.pop_back();
+
+        auto headless = chunks[i];
+        headless.code.erase(0, instruction_size(static_cast<std::byte>(headless.code[0])));
+
+        auto overwritten = chunks[i];
+        overwritten.code[0] = static_cast<char>(0x13 + i % 0xEC);
+
+        for(const auto* damaged : {&truncated, &headless, &overwritten})
+        {
+            (isValid(*damaged) ? accepted : rejected) += 1;
+        }
+    }
+
+    report("verify", "damaged, rejected", static_cast<double>(rejected) / 30.0, checked(rejected + accepted == 3000 && accepted == 0, "%"));
+}
+
+// Cost of one dispatched instruction in each executor, on unoptimized
+// chunks. Times are per source instruction, so the threaded code also gets
+// credit for the pairs it fused.
+
+inline void benchDispatch()
+{
+    const auto chunks = compiled(random_trees(17, 2, 2));
+    std::vector<Vm> vms;
+    std::vector<Threaded> threaded;
+    std::size_t instructions{}, cells{}, fused{};
+
+    for(const auto& chunk : chunks)
+    {
+        auto& t = threaded.emplace_back(verify(chunk));
+        vms.emplace_back(chunk);
+
+        instructions += count_instructions(chunk.code);
+        cells += t.Size();
+        fused += t.FusedPairs();
+    }
+
+    const auto views = verified(chunks);
+    const auto vm = [&](std::size_t i) { return vms[i].Execute(); };
+    const auto sw = [&](std::size_t i) { return exec(views[i]); };
+    const auto ts = [&](std::size_t i) { return threaded[i].RunSwitch(); };
+    const auto tg = [&](std::size_t i) { return threaded[i].Run(); };
+
+    const std::pair<const char*, std::pair<Seconds_t, Data_t>> paths[]
+    {
+        {"Vm::Execute", time_runs(chunks.size(), vm)},
+        {"exec (switch)", time_runs(chunks.size(), sw)},
+        {"threaded, switch", time_runs(chunks.size(), ts)},
+        {"threaded, goto", time_runs(chunks.size(), tg)},
+    };
+
+    for(const auto& [name, result] : paths)
+    {
+        report("dispatch", name, result.first.count() * 1e9 / static_cast<double>(instructions), checked(result.second != 0, "ns/instr"));
+    }
+
+    report("dispatch", "cells", static_cast<double>(cells) / static_cast<double>(instructions) * 100.0, "% of instructions");
+    std::cout << "    fused pairs " << fused << std::endl;
+    differential("threaded results differ", chunks.size(), sw, tg);
+    differential("threaded switch results differ", chunks.size(), sw, ts);
+}
+
+// Native code against every interpreter, per formula, and a differential
+// run: unoptimized chunks must match eval bit for bit, contracted ones (Fma)
+// must match exec.
+
+inline void benchJit()
+{
+    const auto trees = random_trees(19, 1, 4);
+    const auto chunks = compiled(trees);
+    std::vector<Vm> vms;
+    std::vector<Threaded> threaded;
+    std::vector<Jit> jits;
+    std::vector<Chunk_t> contracted;
+    std::size_t native{}, bytes{};
+
+    for(const auto& chunk : chunks)
+    {
+        vms.emplace_back(chunk);
+        threaded.emplace_back(verify(chunk));
+        auto& jit = jits.emplace_back(verify(chunk));
+        contracted.push_back(optimize(chunk, optimizationLevels[1] | Peephole::Contract));
+
+        native += jit.IsNative() ? 1U : 0U;
+        bytes += jit.CodeSize();
+    }
+
+    const auto views = verified(chunks);
+    const auto n = chunks.size();
+
+    const std::pair<const char*, std::pair<Seconds_t, Data_t>> paths[]
+    {
+        {"eval", time_runs(n, [&](std::size_t i) { return eval(trees[i]); })},
+        {"execute (decode)", time_runs(n, [&](std::size_t i) { return execute(views[i]); })},
+        {"exec (switch)", time_runs(n, [&](std::size_t i) { return exec(views[i]); })},
+        {"Vm::Execute", time_runs(n, [&](std::size_t i) { return vms[i].Execute(); })},
+        {"threaded", time_runs(n, [&](std::size_t i) { return threaded[i].Run(); })},
+        {"jit", time_runs(n, [&](std::size_t i) { return jits[i].Run(); })},
+    };
+
+    for(const auto& [name, result] : paths)
+    {
+        report("jit", name, result.first.count() * 1e9 / static_cast<double>(n), checked(result.second != 0, "ns/formula"));
+    }
+
+    const auto t = measure([&]{ for(const auto& c : views) { Jit jit{c}; } }, 10);
+    report("jit", "compile", t.count() * 1e9 / static_cast<double>(n), "ns/formula");
+    report("jit", "code", static_cast<double>(bytes) / static_cast<double>(n), "B/formula");
+    std::cout << "    native " << native << "/" << n << std::endl;
+    differential("jit results differ", n, [&](std::size_t i) { return eval(trees[i]); }, [&](std::size_t i) { return jits[i].Run(); });
+    differential("contracted jit results differ", n, [&](std::size_t i) { return exec(contracted[i]); },
+                 [&](std::size_t i) { return Jit{verify(contracted[i])}.Run(); });
+}
+
+// Closures between the tree walker and the bytecode: per formula run time,
+// build time, and whether results match eval.
+
+inline void benchClosure()
+{
+    const auto trees = random_trees(23, 1, 4);
+    const auto chunks = compiled(trees);
+    std::vector<Closure> closures;
+    std::vector<Threaded> threaded;
+    std::size_t nodes{}, bound{};
+
+    for(std::size_t i = 0; i < trees.size(); ++i)
+    {
+        const auto& closure = closures.emplace_back(trees[i]);
+        threaded.emplace_back(verify(chunks[i]));
+
+        nodes += count_instructions(chunks[i].code) - 1;    // one instruction a tree node, then Return
+        bound += closure.Size();
+    }
+
+    const auto views = verified(chunks);
+    const auto n = trees.size();
+    const auto tree = [&](std::size_t i) { return eval(trees[i]); };
+    const auto closure = [&](std::size_t i) { return closures[i].Run(); };
+
+    const std::pair<const char*, std::pair<Seconds_t, Data_t>> paths[]
+    {
+        {"eval", time_runs(n, tree)},
+        {"closure", time_runs(n, closure)},
+        {"exec", time_runs(n, [&](std::size_t i) { return exec(views[i]); })},
+        {"threaded", time_runs(n, [&](std::size_t i) { return threaded[i].Run(); })},
+    };
+
+    for(const auto& [name, result] : paths)
+    {
+        report("closure", name, result.first.count() * 1e9 / static_cast<double>(n), checked(result.second != 0, "ns/formula"));
+    }
+
+    const auto t = measure([&]{ for(const auto& e : trees) { Closure built{e}; } }, 10);
+    report("closure", "build", t.count() * 1e9 / static_cast<double>(n), "ns/formula");
+    report("closure", "nodes", static_cast<double>(bound) / static_cast<double>(nodes) * 100.0, "% of tree nodes");
+    differential("closure results differ", n, tree, closure);
+}
+
+// A library of 100k formulas: writing it, opening it with and without the
+// CRC check, looking every chunk up by name, verifying it the first time,
+// and running them in place.
+
+inline void benchContainer()
+{
+    Formula_generator gen{29};
+    Chunk_file_writer writer;
+    std::vector<std::string> names;
+
+    for(std::size_t i = 0; names.size() < 100'000; ++i)
+    {
+        auto formula = gen.Formula(4 + i % 16, 1 + i % 3);
+
+        if(writer.Add(formula, compile(pratt(formula)->first)))
+        {
+            names.push_back(std::move(formula));
+        }
+    }
+
+    const auto path = (std::filesystem::temp_directory_path() / "interpreter-bench.xbc").string();
+
+    auto t = measure([&]{ writer.Write(path); });
+    report("container", "write", t.count() * 1e3, "ms");
+    report("container", "size", static_cast<double>(std::filesystem::file_size(path)) / 1e6, "MB");
+
+    t = measure([&]{ Chunk_file file{path}; }, 10);
+    report("container", "open", t.count() * 1e3, "ms");
+
+    t = measure([&]{ Chunk_file file{path, true}; }, 10);
+    report("container", "open, CRC", t.count() * 1e3, "ms");
+
+    const Chunk_file file{path};
+    std::size_t found{};
+
+    t = measure([&]{ for(const auto& name : names) { found += file.Find(name) ? 1U : 0U; } });
+    report("container", "find", t.count() * 1e9 / static_cast<double>(names.size()), checked(found == names.size(), "ns/chunk"));
+
+    Data_t sink{};
+    t = measure([&]{ for(std::size_t i = 0; i < file.Size(); ++i) { sink += exec(file[i]); } });
+    report("container", "exec in place", t.count() * 1e3, checked(sink != 0, "ms"));
+
+    std::filesystem::remove(path);
+}
+
+// A few thousand formulas submitted over and over, with and without the
+// cache, then the same lookups from several threads. A cache smaller than
+// the working set shows the CLOCK eviction.
+
+inline void benchCache()
+{
+    Formula_generator gen{31};
+    std::vector<std::string> formulas;
+    std::vector<std::size_t> workload;
+
+    for(std::size_t i = 0; i < 4000; ++i)
+    {
+        formulas.push_back(gen.Formula(4 + i % 16, 1 + i % 3));
+    }
+
+    for(std::size_t i = 0; i < 200'000; ++i)
+    {
+        // Skewed: a quarter of the formulas get most of the traffic.
+        const auto r = (i * 2654435761U) % 1000;
+        workload.push_back(r < 800 ? (i * 40503U) % 1000 : (i * 40503U) % formulas.size());
+    }
+
+    const auto build = [](std::string_view source) -> std::optional<Chunk_t>
+    {
+        const auto parsed = pratt(source);
+        return parsed ? std::optional{compile(parsed->first)} : std::nullopt;
+    };
+
+    Data_t sink{};
+    auto t = measure([&]{ for(const auto i : workload) { sink += exec(*build(formulas[i])); } });
+    report("cache", "parse + compile", t.count() * 1e9 / static_cast<double>(workload.size()), checked(sink != 0, "ns/formula"));
+
+    // The lex every lookup pays to build its key, hit or not.
+    std::string key;
+    std::size_t keyed{};
+    t = measure([&]{ for(const auto i : workload) { keyed += source_key(formulas[i], key) ? key.size() : 0U; } });
+    report("cache", "lex + key", t.count() * 1e9 / static_cast<double>(workload.size()), checked(keyed != 0, "ns/formula"));
+
+    for(const auto capacity : {std::size_t{8192}, std::size_t{1024}})
+    {
+        Program_cache cache{capacity};
+        t = measure([&]{ for(const auto i : workload) { sink += exec(cache.Get(formulas[i], build)); } });
+
+        const auto stats = cache.Stats();
+        const auto label = "capacity " + std::to_string(capacity);
+        report("cache", label, t.count() * 1e9 / static_cast<double>(workload.size()), "ns/formula");
+        std::cout << "    hits " << stats.hits << ", misses " << stats.misses << ", evictions " << stats.evictions << std::endl;
+    }
+
+    Program_cache shared{8192};
+
+    for(const auto i : workload)
+    {
+        shared.Get(formulas[i], build);
+    }
+
+    for(const auto nbThreads : {1U, 2U, 4U, 8U})
+    {
+        std::vector<std::thread> threads;
+        std::vector<Data_t> sinks(nbThreads);
+
+        t = measure([&]
+        {
+            for(unsigned k = 0; k < nbThreads; ++k)
+            {
+                threads.emplace_back([&, k]
+                {
+                    for(const auto i : workload)
+                    {
+                        sinks[k] += shared.Get(formulas[i], build)->constants.size() > 0 ? 1.0 : 0.0;
+                    }
+                });
+            }
+
+            for(auto& thread : threads)
+            {
+                thread.join();
+            }
+        });
+
+        report("cache", std::to_string(nbThreads) + " threads, lookups", static_cast<double>(workload.size() * nbThreads) / t.count() / 1e6, "M/s");
+    }
+}
+
+// One set of compiled programs run from 1 to 64 threads, each thread with
+// its own Vm loading the shared programs in turn, against threads keeping a
+// Vm built from a copy of every chunk: one copy of the code against one a
+// thread.
+
+inline void benchSharing()
+{
+    std::vector<Program_t> programs;
+    std::size_t bytes{};
+
+    for(auto& chunk : compiled(random_trees(37, 2, 2)))
+    {
+        programs.push_back(make_program(std::move(chunk)));
+        bytes += programs.back()->Bytes();
+    }
+
+    constexpr std::size_t rounds = 20;
+
+    const auto scale = [&](unsigned nbThreads, auto&& run)
+    {
+        std::vector<std::thread> threads;
+        std::vector<Data_t> sinks(nbThreads);
+
+        const auto t = measure([&]
+        {
+            for(unsigned k = 0; k < nbThreads; ++k)
+            {
+                threads.emplace_back([&, k] { sinks[k] = run(); });
+            }
+
+            for(auto& thread : threads)
+            {
+                thread.join();
+            }
+        });
+
+        const auto ok = std::ranges::all_of(sinks, [&](Data_t s) { return s == sinks.front() && s != 0; });
+        return std::pair{static_cast<double>(nbThreads * rounds * programs.size()) / t.count() / 1e6, ok};
+    };
+
+    for(const auto nbThreads : {1U, 2U, 4U, 8U, 16U, 32U, 64U})
+    {
+        const auto [shared, sharedOk] = scale(nbThreads, [&]
+        {
+            Vm vm{programs.front()};
+            Data_t sink{};
+
+            for(std::size_t r = 0; r < rounds; ++r)
+            {
+                for(const auto& program : programs)
+                {
+                    vm.Load(program);
+                    sink += vm.Execute();
+                }
+            }
+
+            return sink;
+        });
+
+        const auto [copied, copiedOk] = scale(nbThreads, [&]
+        {
+            std::vector<Vm> vms;
+            Data_t sink{};
+
+            for(const auto& program : programs)
+            {
+                vms.emplace_back(Chunk_t{*program});
+            }
+
+            for(std::size_t r = 0; r < rounds; ++r)
+            {
+                for(auto& vm : vms)
+                {
+                    sink += vm.Execute();
+                }
+            }
+
+            return sink;
+        });
+
+        const auto label = std::to_string(nbThreads) + " threads, ";
+        report("sharing", label + "shared", shared, checked(sharedOk, "M runs/s"));
+        report("sharing", label + "copies", copied, checked(copiedOk, "M runs/s"));
+        std::cout << "    code resident " << bytes / 1024 << " KiB shared, " << bytes * nbThreads / 1024 << " KiB copied" << std::endl;
+    }
+}
+
+// Runs every benchmark, returns the number of failed checks.
+
+inline auto benchmark() -> std::size_t
+{
+    benchParsers();
+    benchRepetition();
+    benchPackrat();
+    benchStatic();
+    benchFlat();
+    benchCse();
+    benchTraversal();
+    benchRebalance();
+    benchCompile();
+    benchEncoding();
+    benchPeephole();
+    benchDispatch();
+    benchStack();
+    benchRegisters();
+    benchVerify();
+    benchClosure();
+    benchJit();
+    benchContainer();
+    benchCache();
+    benchSharing();
+
+    return failures();
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "Compiler.hpp"
+#include "Lexer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Cache of compiled programs keyed by their tokens: the kind of each, and
+// the value of numbers. Inputs that lex to the same tokens parse to the same
+// tree whatever their spacing, and spacing that changes the tokens, as in
+// `1 2` or `1. 5`, changes the key. Misses compile the original text, and
+// inputs that do not lex are compiled without being cached.
+//
+// Every lookup, hit or miss, lexes its source to build the key: a hit costs
+// a lex of the source on top of the table lookup.
+//
+// The cache is split into shards picked by a 64-bit hash of the key, and
+// keys sharing a hash are chained in the shard's index. Hits
+// take their shard's lock shared and only set a CLOCK reference bit, so
+// readers never block each other; misses compile outside any lock, then
+// insert under the exclusive lock, evicting the first entry the clock hand
+// finds unreferenced. Programs are handed out as shared pointers and stay
+// valid after eviction.
+
+// Key of `source` in `key`, false when a character starts no token.
+inline auto source_key(std::string_view source, std::string& key) -> bool
+{
+    thread_local Tokens_t tokens;
+    lex(source, tokens);
+    key.clear();
+
+    for(const auto& token : tokens)
+    {
+        key.push_back(static_cast<char>(token.kind));
+
+        if(token.kind == Token_kind::Number)
+        {
+            const auto bytes = std::bit_cast<std::array<char, sizeof(double)>>(token.value);
+            key.append(bytes.data(), bytes.size());
+        }
+    }
+
+    return tokens.back().kind != Token_kind::Error;
+}
+
+// FNV-1a.
+inline auto hash_source(std::string_view key) -> std::uint64_t
+{
+    std::uint64_t hash = 0xCBF29CE484222325U;
+
+    for(const auto c : key)
+    {
+        hash = (hash ^ static_cast<std::uint8_t>(c)) * 0x100000001B3U;
+    }
+
+    return hash;
+}
+
+struct Cache_stats
+{
+    std::size_t hits{}, misses{}, evictions{}, size{};
+};
+
+class Program_cache
+{
+public:
+
+    explicit Program_cache(std::size_t capacity = 4096, std::size_t shardCount = 16)
+             : nbShards{std::max<std::size_t>(shardCount, 1)},
+               shards{std::make_unique<Shard[]>(nbShards)}
+    {
+        const auto perShard = std::max<std::size_t>((capacity + nbShards - 1) / nbShards, 1);
+
+        for(std::size_t i = 0; i < nbShards; ++i)
+        {
+            shards[i].capacity = perShard;
+            shards[i].slots = std::make_unique<Slot[]>(perShard);
+            shards[i].index.reserve(perShard);
+        }
+    }
+
+    // The program compiled from `source`, calling build(source)
+    // -> std::optional<Chunk_t> on a miss; null when it returns nothing,
+    // which is not cached.
+    template <typename F>
+    auto Get(std::string_view source, F&& build) -> Program_t
+    {
+        // Keyed into a per-thread buffer: a hit allocates nothing.
+        thread_local std::string key;
+
+        if(!source_key(source, key))
+        {
+            auto chunk = build(source);
+            return chunk ? make_program(std::move(*chunk)) : Program_t{};
+        }
+
+        const auto hash = hash_source(key);
+        auto& shard = shards[hash % nbShards];
+
+        {
+            std::shared_lock lock{shard.mutex};
+
+            if(auto* slot = shard.Find(key, hash))
+            {
+                if(!slot->referenced.load(std::memory_order_relaxed))
+                {
+                    slot->referenced.store(true, std::memory_order_relaxed);
+                }
+
+                shard.hits.fetch_add(1, std::memory_order_relaxed);
+                return slot->program;
+            }
+        }
+
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+
+        auto chunk = build(source);
+
+        if(!chunk)
+        {
+            return {};
+        }
+
+        auto program = make_program(std::move(*chunk));
+
+        std::unique_lock lock{shard.mutex};
+
+        // Compiled meanwhile by another thread: the resident entry stays.
+        if(const auto* slot = shard.Find(key, hash))
+        {
+            return slot->program;
+        }
+
+        shard.index.emplace(hash, shard.Place(key, hash, program));
+        return program;
+    }
+
+    auto Stats() const -> Cache_stats
+    {
+        Cache_stats stats;
+
+        for(std::size_t i = 0; i < nbShards; ++i)
+        {
+            auto& shard = shards[i];
+            stats.hits += shard.hits.load(std::memory_order_relaxed);
+            stats.misses += shard.misses.load(std::memory_order_relaxed);
+            stats.evictions += shard.evictions.load(std::memory_order_relaxed);
+
+            std::shared_lock lock{shard.mutex};
+            stats.size += shard.index.size();
+        }
+
+        return stats;
+    }
+
+private:
+
+    struct Slot
+    {
+        std::string key;
+        std::uint64_t hash{};
+        Program_t program;
+        std::atomic<bool> referenced{};
+    };
+
+    struct Shard
+    {
+        // Slot holding `key`, null if none. Under either lock.
+        auto Find(std::string_view key, std::uint64_t hash) const -> Slot*
+        {
+            const auto [first, last] = index.equal_range(hash);
+
+            for(auto it = first; it != last; ++it)
+            {
+                if(slots[it->second].key == key)
+                {
+                    return &slots[it->second];
+                }
+            }
+
+            return nullptr;
+        }
+
+        // Slot for a new entry, evicting one when full. Under the exclusive lock.
+        auto Place(std::string key, std::uint64_t hash, Program_t program) -> std::size_t
+        {
+            std::size_t victim = size;
+
+            if(size < capacity)
+            {
+                ++size;
+            }
+            else
+            {
+                while(slots[hand].referenced.exchange(false, std::memory_order_relaxed))
+                {
+                    hand = (hand + 1) % capacity;
+                }
+
+                victim = hand;
+                hand = (hand + 1) % capacity;
+
+                const auto [first, last] = index.equal_range(slots[victim].hash);
+                index.erase(std::find_if(first, last, [&](const auto& entry) { return entry.second == victim; }));
+                evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            auto& slot = slots[victim];
+            slot.key = std::move(key);
+            slot.hash = hash;
+            slot.program = std::move(program);
+            slot.referenced.store(false, std::memory_order_relaxed);
+            return victim;
+        }
+
+        mutable std::shared_mutex mutex;
+        std::unordered_multimap<std::uint64_t, std::size_t> index;    // hash → slots, colliding keys chained
+        std::unique_ptr<Slot[]> slots;
+        std::size_t capacity{}, size{}, hand{};
+        std::atomic<std::size_t> hits{}, misses{}, evictions{};
+    };
+
+    std::size_t nbShards;
+    std::unique_ptr<Shard[]> shards;
+};
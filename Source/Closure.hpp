@@ -0,0 +1,173 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "Eval.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Closure compilation: the tree is turned once into nodes that each carry
+// the function evaluating them, specialised on the operator and on which
+// operands are constants. A constant operand is bound into its parent
+// (`c op node`, `node op c`) instead of being a node of its own. Running is
+// then a chain of direct calls, with no std::visit and no bytecode decoding.
+//
+// Constant subtrees are not folded, so every node computes exactly what eval
+// does. Evaluation recurses natively; trees deeper than `closureDepth` are
+// handed to eval, which bounds its native recursion.
+
+inline constexpr std::size_t closureDepth = 4096;
+
+class Closure
+{
+public:
+
+    explicit Closure(const Expr& ast, std::size_t maxDepth = defaultMaxDepth)
+    {
+        std::vector<Operand> operands;
+        std::vector<std::pair<std::size_t, std::size_t>> links;     // children of each node, by index
+        constexpr auto none = static_cast<std::size_t>(-1);
+
+        const auto add = [&](Fn_t fn, std::size_t lhs, std::size_t rhs, Data_t value)
+        {
+            nodes.push_back({fn, nullptr, nullptr, value});
+            links.emplace_back(lhs, rhs);
+            return nodes.size() - 1;
+        };
+
+        // A constant that cannot be bound becomes a node.
+        const auto materialize = [&](const Operand& operand)
+        {
+            return operand.isConst ? add(&Const, none, none, operand.value) : operand.index;
+        };
+
+        const auto pop = [&]
+        {
+            const auto operand = operands.back();
+            operands.pop_back();
+            return operand;
+        };
+
+        post_order(ast, [&](const Expr& node, std::size_t)
+        {
+            std::visit(overloaded
+            {
+                [&](Data_t value) { operands.push_back({true, value, none, 0}); },
+                [&](const Neg&)
+                {
+                    const auto operand = pop();
+                    operands.push_back({false, {}, add(&Negate, materialize(operand), none, {}), operand.height + 1});
+                },
+                [&]<typename B>(const B&)
+                {
+                    using Op = std::conditional_t<std::is_same_v<B, Add>, std::plus<Data_t>,
+                               std::conditional_t<std::is_same_v<B, Sub>, std::minus<Data_t>,
+                               std::conditional_t<std::is_same_v<B, Mul>, std::multiplies<Data_t>, std::divides<Data_t>>>>;
+
+                    const auto rhs = pop();
+                    const auto lhs = pop();
+                    const auto height = std::max(lhs.height, rhs.height) + 1;
+
+                    const auto index = lhs.isConst && !rhs.isConst ? add(&ConstLhs<Op>, none, rhs.index, lhs.value)
+                                     : rhs.isConst ? add(&ConstRhs<Op>, materialize(lhs), none, rhs.value)
+                                     : add(&Binary<Op>, lhs.index, rhs.index, {});
+
+                    operands.push_back({false, {}, index, height});
+                },
+            }, static_cast<const Variant_t&>(node));
+        }, maxDepth);
+
+        const auto top = pop();
+        const auto rootIndex = materialize(top);
+
+        for(std::size_t i = 0; i < nodes.size(); ++i)
+        {
+            nodes[i].lhs = links[i].first != none ? &nodes[links[i].first] : nullptr;
+            nodes[i].rhs = links[i].second != none ? &nodes[links[i].second] : nullptr;
+        }
+
+        root = &nodes[rootIndex];
+
+        if(top.height > closureDepth)
+        {
+            deep = ast;
+        }
+    }
+
+    // Nodes point into the closure.
+    Closure(const Closure&) = delete;
+    auto operator=(const Closure&) -> Closure& = delete;
+    Closure(Closure&&) = default;
+    auto operator=(Closure&&) -> Closure& = default;
+    ~Closure() = default;
+
+    auto Run() const -> Data_t
+    {
+        return deep ? eval(*deep) : root->fn(*root);
+    }
+
+    auto Size() const -> std::size_t
+    {
+        return nodes.size();
+    }
+
+private:
+
+    struct Node;
+
+    using Fn_t = auto (*)(const Node&) -> Data_t;
+
+    struct Node
+    {
+        Fn_t fn;
+        const Node* lhs;
+        const Node* rhs;
+        Data_t value;       // bound constant
+    };
+
+    struct Operand
+    {
+        bool isConst;
+        Data_t value;
+        std::size_t index;
+        std::size_t height;
+    };
+
+    static auto Const(const Node& n) -> Data_t
+    {
+        return n.value;
+    }
+
+    static auto Negate(const Node& n) -> Data_t
+    {
+        return -n.lhs->fn(*n.lhs);
+    }
+
+    template <typename Op>
+    static auto Binary(const Node& n) -> Data_t
+    {
+        return Op{}(n.lhs->fn(*n.lhs), n.rhs->fn(*n.rhs));
+    }
+
+    template <typename Op>
+    static auto ConstLhs(const Node& n) -> Data_t
+    {
+        return Op{}(n.value, n.rhs->fn(*n.rhs));
+    }
+
+    template <typename Op>
+    static auto ConstRhs(const Node& n) -> Data_t
+    {
+        return Op{}(n.lhs->fn(*n.lhs), n.value);
+    }
+
+    std::vector<Node> nodes;
+    const Node* root{};
+    std::optional<Expr> deep;
+};
@@ -1,8 +1,20 @@
 #pragma once
 
-#include <iostream>
-#include <tuple>
-#include <variant>
+#include "Ast.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 // enum class OpCode : uint8_t
@@ -17,151 +29,818 @@
 //     Div,
 // };
 
+// Bytecode: one opcode byte, followed for some instructions by a 1, 2 or 4
+// byte operand (unaligned, host byte order). Constants live apart in a
+// deduplicated, naturally aligned pool that PushConst* index; 0, 1, -1 and
+// small integers have opcodes of their own and need no pool entry.
+
 struct OpCode
 {
     static constexpr std::byte NoOp{0x00};
-    static constexpr std::byte Push{0x01}; 
+    static constexpr std::byte PushConst8{0x01};    // std::uint8_t pool index
     static constexpr std::byte Return{0x02};
-    static constexpr std::byte Neg{0x03};  
+    static constexpr std::byte Neg{0x03};
     static constexpr std::byte Add{0x04};
-    static constexpr std::byte Sub{0x05};  
+    static constexpr std::byte Sub{0x05};
     static constexpr std::byte Mul{0x06};
     static constexpr std::byte Div{0x07};
+    static constexpr std::byte Store{0x08};         // Slot_t operand, keeps the value on the stack
+    static constexpr std::byte Load{0x09};          // Slot_t operand
+    static constexpr std::byte PushConst16{0x0A};   // std::uint16_t pool index
+    static constexpr std::byte PushConst32{0x0B};   // std::uint32_t pool index
+    static constexpr std::byte PushInt8{0x0C};      // std::int8_t value
+    static constexpr std::byte PushZero{0x0D};
+    static constexpr std::byte PushOne{0x0E};
+    static constexpr std::byte PushMinusOne{0x0F};
+    static constexpr std::byte PushInt16{0x10};     // std::int16_t value
+    static constexpr std::byte AddImm{0x11};        // std::uint16_t pool index, adds it to the top
+    static constexpr std::byte Fma{0x12};           // a b c → std::fma(a, b, c)
 };
 
-namespace OpCodes
+using Slot_t = std::uint32_t;
+
+// Size of the instruction starting with `code`, operand included.
+
+constexpr auto instruction_size(std::byte code) -> std::size_t
 {
-    struct NoOp {};
-    struct Push { Data_t value{}; };
-    struct Return {};
-    struct Neg { Data_t lhs{}, rhs{}; };
-    struct Add { Data_t lhs{}, rhs{}; };
-    struct Sub { Data_t lhs{}, rhs{}; };
-    struct Mul { Data_t lhs{}, rhs{}; };
-    struct Div { Data_t lhs{}, rhs{}; };
+    if(code == OpCode::PushConst8 || code == OpCode::PushInt8)
+    {
+        return 2;
+    }
 
-    struct Code : std::variant<NoOp, Push, Return, Neg, Add, Sub, Mul, Div>
+    if(code == OpCode::PushConst16 || code == OpCode::PushInt16 || code == OpCode::AddImm)
     {
-        using variant::variant;
-    };
+        return 3;
+    }
+
+    if(code == OpCode::PushConst32)
+    {
+        return 1 + sizeof(std::uint32_t);
+    }
+
+    if(code == OpCode::Store || code == OpCode::Load)
+    {
+        return 1 + sizeof(Slot_t);
+    }
+
+    return 1;
+}
+
+constexpr auto is_push(std::byte code) -> bool
+{
+    return code == OpCode::PushConst8 || code == OpCode::PushConst16 || code == OpCode::PushConst32
+        || code == OpCode::PushInt8 || code == OpCode::PushInt16
+        || code == OpCode::PushZero || code == OpCode::PushOne || code == OpCode::PushMinusOne;
+}
+
+// Net number of values an instruction pushes.
+
+constexpr auto stack_effect(std::byte code) -> int
+{
+    if(is_push(code) || code == OpCode::Load)
+    {
+        return 1;
+    }
+
+    if(code == OpCode::Add || code == OpCode::Sub || code == OpCode::Mul || code == OpCode::Div)
+    {
+        return -1;
+    }
+
+    return code == OpCode::Fma ? -2 : 0;
+}
+
+// Height of the stack after some code, and the highest it got on the way.
+
+struct Stack_depth
+{
+    std::size_t height{}, max{};
+
+    constexpr void Apply(std::byte code)
+    {
+        const auto effect = stack_effect(code);
+        height = effect < 0 ? height - std::min(height, static_cast<std::size_t>(-effect)) : height + static_cast<std::size_t>(effect);
+        max = std::max(max, height);
+    }
+};
+
+constexpr auto stack_depth(std::string_view code, Stack_depth from = {}) -> Stack_depth
+{
+    for(std::size_t pos = 0; pos < code.size(); pos += instruction_size(static_cast<std::byte>(code[pos])))
+    {
+        from.Apply(static_cast<std::byte>(code[pos]));
+    }
+
+    return from;
+}
+
+inline auto count_instructions(std::string_view code) -> std::size_t
+{
+    std::size_t count{};
+
+    for(std::size_t pos = 0; pos < code.size(); pos += instruction_size(static_cast<std::byte>(code[pos])))
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+// How a value is pushed: an operand-free opcode, an int8 or int16
+// immediate, or a pool entry. Bitwise, so -0.0 is not pushed as 0.
+
+struct Push_encoding
+{
+    std::byte code;
+    std::int16_t immediate;
+    bool pooled;
+};
+
+constexpr auto encode_push(Data_t value) -> Push_encoding
+{
+    const auto bits = std::bit_cast<std::uint64_t>(value);
+
+    if(bits == std::bit_cast<std::uint64_t>(0.0))
+    {
+        return {OpCode::PushZero, 0, false};
+    }
+
+    if(value == 1.0)
+    {
+        return {OpCode::PushOne, 0, false};
+    }
+
+    if(value == -1.0)
+    {
+        return {OpCode::PushMinusOne, 0, false};
+    }
+
+    // -0.0 == 0 but must keep its sign: it goes to the pool.
+    if(value >= -32768.0 && value <= 32767.0 && value != 0.0 && value == static_cast<Data_t>(static_cast<std::int16_t>(value)))
+    {
+        const auto immediate = static_cast<std::int16_t>(value);
+        return {immediate >= -128 && immediate <= 127 ? OpCode::PushInt8 : OpCode::PushInt16, immediate, false};
+    }
+
+    return {OpCode::PushConst32, 0, true};
+}
+
+// The narrowest PushConst for a pool index, and its operand size.
+
+constexpr auto pool_push(std::size_t index) -> std::pair<std::byte, std::size_t>
+{
+    if(index <= 0xFF)
+    {
+        return {OpCode::PushConst8, 1};
+    }
+
+    if(index <= 0xFFFF)
+    {
+        return {OpCode::PushConst16, 2};
+    }
+
+    return {OpCode::PushConst32, 4};
+}
+
+// A compiled chunk: code bytes, the constant pool they index and the
+// deepest the stack gets, which executors size their stack from. Executors
+// take a Chunk_view so they run on chunks stored elsewhere without copies.
+
+struct Chunk_t
+{
+    std::vector<Data_t> constants;
+    std::string code;
+    std::size_t depth{};    // maximum stack depth, set by Chunk_builder
+
+    auto operator==(const Chunk_t&) const -> bool = default;
+
+    // Resident size: what a compiled formula costs in memory.
+    auto Bytes() const -> std::size_t
+    {
+        return code.size() + constants.size() * sizeof(Data_t);
+    }
+};
+
+struct Chunk_view
+{
+    std::span<const Data_t> constants;
+    std::string_view code;
+    std::size_t depth{};
+
+    constexpr Chunk_view() = default;
+    constexpr Chunk_view(std::span<const Data_t> k, std::string_view c, std::size_t d) : constants{k}, code{c}, depth{d} {}
+    constexpr Chunk_view(std::span<const Data_t> k, std::string_view c) : Chunk_view{k, c, stack_depth(c).max} {}
+    Chunk_view(const Chunk_t& c) : constants{c.constants}, code{c.code}, depth{c.depth} {}
+};
+
+// Operands are unaligned: always read them through memcpy.
+
+template <typename T>
+auto read_operand(const char* at) -> T
+{
+    T operand;
+    std::memcpy(&operand, at, sizeof(T));
+    return operand;
 }
 
+// One instruction with its pushed value resolved, for the executors that
+// favour clarity over speed (execute, debug).
 
-// using OpCodes = std::tuple<uint8_t, Data_t>;
-using Chunk_t = std::vector<OpCodes::Code>;
-using Chunk_type = std::string;
+struct Instruction
+{
+    std::byte code;
+    Data_t value;           // pushes, AddImm
+    Slot_t slot;            // Store/Load
+    std::size_t size;
+};
 
-auto _compileExpressions(const Chunk_t& c, const auto&... expressions)
+inline auto decode(Chunk_view chunk, std::size_t pos) -> Instruction
 {
-    Chunk_t newChunk = c;
+    const auto code = static_cast<std::byte>(chunk.code[pos]);
+    const auto* operand = chunk.code.data() + pos + 1;
 
-    ((newChunk = _compileExpr(expressions, newChunk)), ...);
+    Instruction instruction{code, {}, {}, instruction_size(code)};
+
+    if(code == OpCode::PushConst8)
+    {
+        instruction.value = chunk.constants[read_operand<std::uint8_t>(operand)];
+    }
+    else if(code == OpCode::PushConst16 || code == OpCode::AddImm)
+    {
+        instruction.value = chunk.constants[read_operand<std::uint16_t>(operand)];
+    }
+    else if(code == OpCode::PushConst32)
+    {
+        instruction.value = chunk.constants[read_operand<std::uint32_t>(operand)];
+    }
+    else if(code == OpCode::PushInt8)
+    {
+        instruction.value = read_operand<std::int8_t>(operand);
+    }
+    else if(code == OpCode::PushInt16)
+    {
+        instruction.value = read_operand<std::int16_t>(operand);
+    }
+    else if(code == OpCode::PushZero || code == OpCode::PushOne || code == OpCode::PushMinusOne)
+    {
+        instruction.value = code == OpCode::PushZero ? 0.0 : code == OpCode::PushOne ? 1.0 : -1.0;
+    }
+    else if(code == OpCode::Store || code == OpCode::Load)
+    {
+        instruction.slot = read_operand<Slot_t>(operand);
+    }
 
-    return newChunk;
+    return instruction;
 }
 
-auto _compileExpr(const auto& ast, const Chunk_t& c) -> Chunk_t
-{
-    auto newChunk = c;
-    const auto r = std::visit(overloaded
-    {
-        [](Data_t value) -> OpCodes::Code { return OpCodes::Push{value}; },
-        [&](const Neg& n) -> OpCodes::Code
-        { 
-            newChunk = _compileExpr(*n.expr, c);
-            return OpCodes::Neg{}; 
-        },
-        [&](const Add& n) -> OpCodes::Code
-        {
-            newChunk = _compileExpressions(newChunk, *n.lhs, *n.rhs);
-            return OpCodes::Add{}; 
-        },
-        [&](const Mul& n) -> OpCodes::Code
-        {
-            newChunk = _compileExpressions(newChunk, *n.lhs, *n.rhs);
-            return OpCodes::Mul{}; 
-        },
-        [&](const Sub& n) -> OpCodes::Code
-        { 
-            newChunk = _compileExpressions(newChunk, *n.lhs, *n.rhs);
-            return OpCodes::Sub{}; 
-        },
-        [&](const Div& n) -> OpCodes::Code
-        { 
-            newChunk = _compileExpressions(newChunk, *n.lhs, *n.rhs);
-            return OpCodes::Div{}; 
-        },
-        [](auto) -> OpCodes::Code { return OpCodes::NoOp{}; },
-    }, ast);
-
-    newChunk.push_back(r);
-
-    return newChunk;
+// Load-time verifier. Executors check nothing while running: they take for
+// granted that opcodes are valid, operands and pool indices in bounds, that
+// nothing underflows, that the chunk's depth is not understated, and that
+// it ends with its only Return, leaving one value. Chunks from outside the
+// compiler must pass verify first.
+
+class Bytecode_error : public std::runtime_error
+{
+public:
+
+    Bytecode_error(std::size_t offset, const std::string& what)
+        : std::runtime_error{"bytecode offset " + std::to_string(offset) + ": " + what}
+    {
+    }
+};
+
+// A compiled chunk shared between threads and owners: immutable once built,
+// copying it only counts a reference. Only make_program makes one, after
+// verifying the chunk, so programs run unchecked.
+
+class Program_t;
+
+inline auto make_program(Chunk_t chunk) -> Program_t;
+
+class Program_t
+{
+public:
+
+    Program_t() = default;
+
+    auto operator*() const -> const Chunk_t&
+    {
+        return *chunk;
+    }
+
+    auto operator->() const -> const Chunk_t*
+    {
+        return chunk.get();
+    }
+
+    explicit operator bool() const
+    {
+        return chunk != nullptr;
+    }
+
+private:
+
+    explicit Program_t(std::shared_ptr<const Chunk_t> c) : chunk{std::move(c)} {}
+
+    friend auto make_program(Chunk_t chunk) -> Program_t;
+
+    std::shared_ptr<const Chunk_t> chunk;
+};
+
+// A chunk verify accepted, or a program's: what the unchecked executors
+// run. Only verify and make_program vouch for a chunk, and Chunk_file for
+// those it has verified once, so nothing else makes one.
+
+class Verified_chunk;
+class Chunk_file;
+
+inline auto verify(Chunk_view chunk) -> Verified_chunk;
+
+class Verified_chunk
+{
+public:
+
+    // Throws on an empty program, default-constructed or moved from.
+    explicit Verified_chunk(const Program_t& program)
+    {
+        if(!program)
+        {
+            throw Bytecode_error{0, "empty program"};
+        }
+
+        chunk = *program;
+    }
+
+    operator Chunk_view() const
+    {
+        return chunk;
+    }
+
+private:
+
+    explicit Verified_chunk(Chunk_view c) : chunk{c} {}
+
+    friend auto verify(Chunk_view chunk) -> Verified_chunk;
+    friend class Chunk_file;
+
+    Chunk_view chunk;
+};
+
+inline auto verify(Chunk_view chunk) -> Verified_chunk
+{
+    Stack_depth depth;
+    std::size_t slotCount{};
+    std::size_t pos{};
+    bool isReturned{};
+
+    for(; pos < chunk.code.size() && !isReturned; pos += instruction_size(static_cast<std::byte>(chunk.code[pos])))
+    {
+        const auto code = static_cast<std::byte>(chunk.code[pos]);
+        const auto* operand = chunk.code.data() + pos + 1;
+
+        const auto fail = [&](const char* what) { throw Bytecode_error{pos, what}; };
+
+        if(code > OpCode::Fma)
+        {
+            fail("invalid opcode");
+        }
+
+        if(instruction_size(code) > chunk.code.size() - pos)
+        {
+            fail("truncated operand");
+        }
+
+        const auto index = code == OpCode::PushConst8 ? read_operand<std::uint8_t>(operand)
+                         : code == OpCode::PushConst16 || code == OpCode::AddImm ? read_operand<std::uint16_t>(operand)
+                         : code == OpCode::PushConst32 ? read_operand<std::uint32_t>(operand)
+                         : std::size_t{0};
+
+        if((code == OpCode::PushConst8 || code == OpCode::PushConst16 || code == OpCode::PushConst32 || code == OpCode::AddImm)
+           && index >= chunk.constants.size())
+        {
+            fail("constant out of the pool");
+        }
+
+        const auto operands = code == OpCode::Fma ? 3U
+                            : code == OpCode::Add || code == OpCode::Sub || code == OpCode::Mul || code == OpCode::Div ? 2U
+                            : code == OpCode::Neg || code == OpCode::AddImm || code == OpCode::Store || code == OpCode::Return ? 1U
+                            : 0U;
+
+        if(depth.height < operands)
+        {
+            fail("stack underflow");
+        }
+
+        if(code == OpCode::Store || code == OpCode::Load)
+        {
+            const auto slot = read_operand<Slot_t>(operand);
+
+            // Slots are resized on Store: bound them by the code size.
+            if(code == OpCode::Store && slot >= chunk.code.size())
+            {
+                fail("slot out of range");
+            }
+
+            if(code == OpCode::Load && slot >= slotCount)
+            {
+                fail("load past the stored slots");
+            }
+
+            slotCount = std::max<std::size_t>(slotCount, slot + std::size_t{1});
+        }
+
+        if(code == OpCode::Return)
+        {
+            if(depth.height != 1)
+            {
+                fail("unbalanced stack at Return");
+            }
+
+            isReturned = true;
+        }
+
+        depth.Apply(code);
+    }
+
+    if(!isReturned)
+    {
+        throw Bytecode_error{pos, "missing Return"};
+    }
+
+    if(pos != chunk.code.size())
+    {
+        throw Bytecode_error{pos, "code after Return"};
+    }
+
+    if(depth.max > chunk.depth)
+    {
+        throw Bytecode_error{0, "stack deeper than recorded"};
+    }
+
+    return Verified_chunk{chunk};
 }
 
 
-auto _compile(const auto& ast) -> Chunk_t
+inline auto make_program(Chunk_t chunk) -> Program_t
 {
-    Chunk_t c;
-    return _compileExpr(ast, c);
+    verify(chunk);
+    return Program_t{std::make_shared<const Chunk_t>(std::move(chunk))};
 }
 
-auto compileExpressions(const Chunk_type& c, const auto&... expressions)
+// Appends bytecode to one output buffer, reserved up front when the caller
+// knows the size: compiling is a single post-order walk (see post_order)
+// with no intermediate chunks. Pushed constants are interned in the pool.
+
+class Chunk_builder
 {
-    Chunk_type newChunk = c;
+public:
+
+    explicit Chunk_builder(std::size_t reserve = 0, Chunk_t prefix = {}) : chunk{std::move(prefix)}, depth{stack_depth(chunk.code)}
+    {
+        chunk.code.reserve(chunk.code.size() + reserve);
+        Rehash();
+    }
+
+    void Emit(std::byte code)
+    {
+        chunk.code += static_cast<char>(code);
+        depth.Apply(code);
+    }
+
+    template <typename T>
+    void Emit(std::byte code, const T& operand)
+    {
+        chunk.code += static_cast<char>(code);
+        depth.Apply(code);
+        chunk.code.append(reinterpret_cast<const char*>(&operand), sizeof(T));
+    }
+
+    void Push(Data_t value)
+    {
+        const auto encoding = encode_push(value);
+
+        if(!encoding.pooled)
+        {
+            if(encoding.code == OpCode::PushInt8)
+            {
+                Emit(encoding.code, static_cast<std::int8_t>(encoding.immediate));
+            }
+            else if(encoding.code == OpCode::PushInt16)
+            {
+                Emit(encoding.code, encoding.immediate);
+            }
+            else
+            {
+                Emit(encoding.code);
+            }
+
+            return;
+        }
+
+        const auto index = Intern(value);
+
+        switch(pool_push(index).second)
+        {
+            case 1: Emit(OpCode::PushConst8, static_cast<std::uint8_t>(index)); break;
+            case 2: Emit(OpCode::PushConst16, static_cast<std::uint16_t>(index)); break;
+            default: Emit(OpCode::PushConst32, index); break;
+        }
+    }
+
+    // Adds a pooled constant to the top of the stack; Push + Add when the
+    // pool index does not fit AddImm's operand.
+    void AddImm(Data_t value)
+    {
+        const auto index = Intern(value);
+
+        if(index <= 0xFFFF)
+        {
+            Emit(OpCode::AddImm, static_cast<std::uint16_t>(index));
+            return;
+        }
+
+        Push(value);
+        Emit(OpCode::Add);
+    }
+
+    void Node(const Expr& e)
+    {
+        std::visit(overloaded
+        {
+            [&](Data_t value) { Push(value); },
+            [&](const Neg&) { Emit(OpCode::Neg); },
+            [&](const Add&) { Emit(OpCode::Add); },
+            [&](const Mul&) { Emit(OpCode::Mul); },
+            [&](const Sub&) { Emit(OpCode::Sub); },
+            [&](const Div&) { Emit(OpCode::Div); },
+        }, static_cast<const Variant_t&>(e));
+    }
+
+    void Expression(const Expr& ast)
+    {
+        post_order(ast, [&](const Expr& e, std::size_t) { Node(e); });
+    }
+
+    auto Size() const -> std::size_t
+    {
+        return chunk.code.size();
+    }
+
+    // Ends the chunk with Return and hands it over.
+    auto Finish() -> Chunk_t
+    {
+        Emit(OpCode::Return);
+        chunk.depth = depth.max;
+        return std::move(chunk);
+    }
+
+    // Hands the chunk over as is, for chunks that get more code later.
+    auto Take() -> Chunk_t
+    {
+        chunk.depth = depth.max;
+        return std::move(chunk);
+    }
+
+private:
+
+    // Open addressing on the value bits, 1 + pool index per bucket (0: free),
+    // kept at most half full.
+    auto Bucket(std::uint64_t bits) const -> std::size_t
+    {
+        return static_cast<std::size_t>((bits * 0x9E3779B97F4A7C15ULL) >> 32) & (buckets.size() - 1);
+    }
+
+    auto Intern(Data_t value) -> std::uint32_t
+    {
+        const auto bits = std::bit_cast<std::uint64_t>(value);
+
+        for(auto b = Bucket(bits); buckets[b] != 0; b = (b + 1) & (buckets.size() - 1))
+        {
+            if(std::bit_cast<std::uint64_t>(chunk.constants[buckets[b] - 1]) == bits)
+            {
+                return buckets[b] - 1;
+            }
+        }
+
+        chunk.constants.push_back(value);
+
+        if(chunk.constants.size() * 2 > buckets.size())
+        {
+            Rehash();
+        }
+        else
+        {
+            Place(chunk.constants.size() - 1);
+        }
+
+        return static_cast<std::uint32_t>(chunk.constants.size() - 1);
+    }
+
+    void Place(std::size_t index)
+    {
+        auto b = Bucket(std::bit_cast<std::uint64_t>(chunk.constants[index]));
+
+        while(buckets[b] != 0)
+        {
+            b = (b + 1) & (buckets.size() - 1);
+        }
 
-    ((newChunk += compileExpr(expressions, newChunk)), ...);
+        buckets[b] = static_cast<std::uint32_t>(index + 1);
+    }
+
+    void Rehash()
+    {
+        buckets.assign(std::max<std::size_t>(64, std::bit_ceil(chunk.constants.size() * 4)), 0);
+
+        for(std::size_t i = 0; i < chunk.constants.size(); ++i)
+        {
+            Place(i);
+        }
+    }
+
+    Chunk_t chunk;
+    Stack_depth depth;
+    std::vector<std::uint32_t> buckets;
+};
 
-    return newChunk;
+auto compileExpr(const auto& ast, Chunk_t c) -> Chunk_t
+{
+    Chunk_builder builder{0, std::move(c)};
+    builder.Expression(ast);
+    return builder.Take();
+}
+
+auto compileExpressions(Chunk_t c, const auto&... expressions) -> Chunk_t
+{
+    Chunk_builder builder{0, std::move(c)};
+    (builder.Expression(expressions), ...);
+    return builder.Take();
 }
 
-auto compileExpr(const auto& ast, const Chunk_type& c) -> Chunk_type
-{
-    auto newChunk = c;
-    const auto r = std::visit(overloaded
-    {
-        [](Data_t value) -> std::string 
-        { 
-            const auto op = static_cast<char>(OpCode::Push);
-            return op + std::string{reinterpret_cast<char*>(&value), sizeof(Data_t)};
-        },
-        [&](const Neg& e) -> std::string
-        {
-            newChunk = compileExpr(*e.expr, newChunk);
-            return {static_cast<char>(OpCode::Neg)};
-        },
-        [&](const Add& e) -> std::string
-        {
-            newChunk = compileExpressions(newChunk, *e.lhs, *e.rhs);
-            return {static_cast<char>(OpCode::Add)};
-        },
-        [&](const Mul& e) -> std::string
-        {
-            newChunk = compileExpressions(newChunk, *e.lhs, *e.rhs);
-            return {static_cast<char>(OpCode::Mul)};
-        },
-        [&](const Sub& e) -> std::string
-        { 
-            newChunk = compileExpressions(newChunk, *e.lhs, *e.rhs);
-            return {static_cast<char>(OpCode::Sub)};
-        },
-        [&](const Div& e) -> std::string
-        { 
-            newChunk = compileExpressions(newChunk, *e.lhs, *e.rhs);
-            return {static_cast<char>(OpCode::Div)};
-        },
-        // [](auto) -> std::string 
-        // { 
-        //     return {}; 
-        // },
-    }, ast);
-
-    return newChunk + r;
+// `reserve`: expected code size in bytes, when the caller knows it.
+auto compile(const auto& ast, std::size_t reserve = 0) -> Chunk_t
+{
+    Chunk_builder builder{reserve};
+    builder.Expression(ast);
+    return builder.Finish();
 }
 
-auto compile(const auto& ast) -> Chunk_type
+// Register bytecode: three-address instructions of a fixed 12 bytes,
+// `Add r3, r1, k2`. Binary operators come in four variants by operand kind,
+// register or pool constant, so constants are read in place rather than
+// pushed: a formula takes one instruction per operator plus its Return.
+
+enum class Reg_op : std::uint8_t
+{
+    AddRR, AddRK, AddKR, AddKK,
+    SubRR, SubRK, SubKR, SubKK,
+    MulRR, MulRK, MulKR, MulKK,
+    DivRR, DivRK, DivKR, DivKK,
+    Neg,            // dst, a
+    LoadK,          // dst, a: pool index
+    Return,         // a
+};
+
+inline constexpr std::size_t maxRegisters = std::size_t{1} << 16;
+
+struct Reg_instruction
 {
-    const Chunk_type c;
-    const auto bytecode = compileExpr(ast, c);
-    return bytecode + static_cast<char>(OpCode::Return);
-}
\ No newline at end of file
+    Reg_op op;
+    std::uint8_t reserved;
+    std::uint16_t dst;
+    std::uint32_t a, b;     // registers or pool indices, as the opcode says
+};
+
+static_assert(sizeof(Reg_instruction) == 12);
+
+struct Reg_chunk_t
+{
+    std::vector<Data_t> constants;
+    std::vector<Reg_instruction> code;
+    std::size_t registers{};
+
+    auto Bytes() const -> std::size_t
+    {
+        return code.size() * sizeof(Reg_instruction) + constants.size() * sizeof(Data_t);
+    }
+};
+
+// Two passes. The tree is first lowered in post-order to instructions on
+// virtual registers, one per operator node, constants becoming K operands.
+// A linear scan then maps them to registers: every value is used once, so
+// its interval ends at its only use, where its register is freed before the
+// instruction's own result gets one. Registers are as many as the stack
+// code's depth at most; past maxRegisters, Depth_error.
+
+inline auto compile_registers(const Expr& ast) -> Reg_chunk_t
+{
+    struct Operand
+    {
+        bool isConst;
+        std::uint32_t index;    // pool index, or the defining instruction
+    };
+
+    Reg_chunk_t chunk;
+    std::vector<Operand> operands;
+    std::vector<std::array<Operand, 2>> uses;
+    std::unordered_map<std::uint64_t, std::uint32_t> pool;
+
+    const auto pop = [&]
+    {
+        const auto operand = operands.back();
+        operands.pop_back();
+        return operand;
+    };
+
+    const auto intern = [&](Data_t value)
+    {
+        const auto [it, isNew] = pool.try_emplace(std::bit_cast<std::uint64_t>(value), static_cast<std::uint32_t>(chunk.constants.size()));
+
+        if(isNew)
+        {
+            chunk.constants.push_back(value);
+        }
+
+        return it->second;
+    };
+
+    const auto emit = [&](Reg_op op, Operand a, Operand b)
+    {
+        chunk.code.push_back({op, 0, 0, a.index, b.index});
+        uses.push_back({a, b});
+        operands.push_back({false, static_cast<std::uint32_t>(chunk.code.size() - 1)});
+    };
+
+    const auto binary = [&](Reg_op rr)
+    {
+        const auto rhs = pop();
+        const auto lhs = pop();
+        const auto kinds = (lhs.isConst ? 2U : 0U) + (rhs.isConst ? 1U : 0U);
+        emit(static_cast<Reg_op>(static_cast<unsigned>(rr) + kinds), lhs, rhs);
+    };
+
+    post_order(ast, [&](const Expr& e, std::size_t)
+    {
+        std::visit(overloaded
+        {
+            [&](Data_t value) { operands.push_back({true, intern(value)}); },
+            [&](const Neg&)
+            {
+                auto operand = pop();
+
+                if(operand.isConst)
+                {
+                    emit(Reg_op::LoadK, operand, {true, 0});
+                    operand = pop();
+                }
+
+                emit(Reg_op::Neg, operand, {true, 0});
+            },
+            [&](const Add&) { binary(Reg_op::AddRR); },
+            [&](const Sub&) { binary(Reg_op::SubRR); },
+            [&](const Mul&) { binary(Reg_op::MulRR); },
+            [&](const Div&) { binary(Reg_op::DivRR); },
+        }, static_cast<const Variant_t&>(e));
+    });
+
+    if(operands.back().isConst)
+    {
+        emit(Reg_op::LoadK, pop(), {true, 0});
+    }
+
+    // Linear scan: `assigned` maps an instruction to its result register.
+    std::vector<std::uint16_t> assigned(chunk.code.size());
+    std::vector<std::uint16_t> free;
+
+    const auto release = [&](std::uint32_t& field, Operand operand)
+    {
+        if(!operand.isConst)
+        {
+            field = assigned[operand.index];
+            free.push_back(assigned[operand.index]);
+        }
+    };
+
+    for(std::size_t i = 0; i < chunk.code.size(); ++i)
+    {
+        auto& instruction = chunk.code[i];
+        release(instruction.a, uses[i][0]);
+        release(instruction.b, uses[i][1]);
+
+        if(free.empty())
+        {
+            if(chunk.registers == maxRegisters)
+            {
+                throw Depth_error{maxRegisters};
+            }
+
+            free.push_back(static_cast<std::uint16_t>(chunk.registers++));
+        }
+
+        instruction.dst = assigned[i] = free.back();
+        free.pop_back();
+    }
+
+    chunk.code.push_back({Reg_op::Return, 0, 0, assigned.back(), 0});
+    return chunk;
+}
@@ -0,0 +1,489 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "Compiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Compile-time front end: compile_expr<"1 + 2 * 3">() parses and compiles a
+// string literal during constant evaluation, into the same bytecode format
+// as compile(), stored in fixed-size arrays (code and constant pool). Syntax
+// errors are compile errors, and so are literals it cannot parse exactly
+// (see Static_parser::Number).
+//
+// Every expression of the language is constant, so by default the chunk is
+// folded to `Push value; Return`; Fold::None keeps the full instruction stream
+// and evaluates nothing, so `1 / 0` compiles and `value` stays zero.
+
+template <std::size_t N>
+struct Fixed_string
+{
+    char data[N]{};
+
+    consteval Fixed_string(const char (&s)[N])
+    {
+        std::copy_n(s, N, data);
+    }
+
+    constexpr auto View() const -> std::string_view
+    {
+        return {data, N - 1};
+    }
+};
+
+template <std::size_t N, std::size_t K>
+struct Static_chunk
+{
+    std::array<char, N> code{};
+    std::array<Data_t, K> constants{};
+    Data_t value{};
+
+    constexpr auto View() const -> Chunk_view
+    {
+        return {constants, {code.data(), code.size()}};
+    }
+};
+
+enum class Fold
+{
+    None,
+    Constant,
+};
+
+namespace detail
+{
+    // Index of `value` in `pool`, appended if missing: same interning, by
+    // bits, as Chunk_builder.
+    template <typename Pool>
+    constexpr auto intern(Pool& pool, std::size_t& count, Data_t value) -> std::size_t
+    {
+        const auto bits = std::bit_cast<std::uint64_t>(value);
+
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            if(std::bit_cast<std::uint64_t>(pool[i]) == bits)
+            {
+                return i;
+            }
+        }
+
+        if constexpr(requires { pool.push_back(value); })
+        {
+            pool.push_back(value);
+        }
+        else
+        {
+            pool[count] = value;
+        }
+
+        return count++;
+    }
+
+    // Counts the code bytes and distinct pooled constants of an expression.
+    struct Size_emitter
+    {
+        std::size_t size{};
+        std::size_t constants{};
+        std::vector<Data_t> pool;
+
+        constexpr void Op(std::byte)
+        {
+            size += 1;
+        }
+
+        constexpr void Push(Data_t value)
+        {
+            const auto encoding = encode_push(value);
+
+            if(!encoding.pooled)
+            {
+                size += instruction_size(encoding.code);
+                return;
+            }
+
+            size += 1 + pool_push(intern(pool, constants, value)).second;
+        }
+    };
+
+    template <std::size_t N, std::size_t K>
+    struct Code_emitter
+    {
+        std::array<char, N>& code;
+        std::array<Data_t, K>& pool;
+        std::size_t size{};
+        std::size_t constants{};
+
+        constexpr void Op(std::byte op)
+        {
+            code[size++] = static_cast<char>(op);
+        }
+
+        template <typename T>
+        constexpr void Operand(T operand)
+        {
+            const auto bytes = std::bit_cast<std::array<char, sizeof(T)>>(operand);
+            std::copy(bytes.begin(), bytes.end(), code.begin() + static_cast<std::ptrdiff_t>(size));
+            size += sizeof(T);
+        }
+
+        constexpr void Push(Data_t value)
+        {
+            const auto encoding = encode_push(value);
+
+            if(!encoding.pooled)
+            {
+                Op(encoding.code);
+
+                if(encoding.code == OpCode::PushInt8)
+                {
+                    Operand(static_cast<std::int8_t>(encoding.immediate));
+                }
+                else if(encoding.code == OpCode::PushInt16)
+                {
+                    Operand(encoding.immediate);
+                }
+
+                return;
+            }
+
+            const auto index = intern(pool, constants, value);
+            const auto [op, width] = pool_push(index);
+            Op(op);
+
+            switch(width)
+            {
+                case 1: Operand(static_cast<std::uint8_t>(index)); break;
+                case 2: Operand(static_cast<std::uint16_t>(index)); break;
+                default: Operand(static_cast<std::uint32_t>(index)); break;
+            }
+        }
+    };
+
+    // Recursive descent over the same grammar as expression(), emitting in
+    // post-order and, when `evaluating`, evaluating as it goes.
+    template <typename Emitter>
+    class Static_parser
+    {
+    public:
+
+        constexpr Static_parser(std::string_view in, Emitter& e, bool evaluating = true) : input{in}, emit{e}, isEvaluating{evaluating} {}
+
+        constexpr auto Parse() -> Data_t
+        {
+            const auto value = Term();
+
+            if(pos != input.size())
+            {
+                throw std::invalid_argument{"unexpected character in expression"};
+            }
+
+            emit.Op(OpCode::Return);
+            return value;
+        }
+
+    private:
+
+        constexpr void SkipSpaces()
+        {
+            constexpr std::string_view spaces{" \t\n\v\f\r"};
+
+            while(pos < input.size() && spaces.find(input[pos]) != std::string_view::npos)
+            {
+                ++pos;
+            }
+        }
+
+        constexpr auto Accept(char c) -> bool
+        {
+            SkipSpaces();
+
+            if(pos < input.size() && input[pos] == c)
+            {
+                ++pos;
+                return true;
+            }
+
+            return false;
+        }
+
+        // Emits `op` and applies it to the operands, when evaluating.
+        constexpr auto Apply(std::byte op, Data_t lhs, Data_t rhs = 0) -> Data_t
+        {
+            emit.Op(op);
+
+            if(!isEvaluating)
+            {
+                return 0;
+            }
+
+            return op == OpCode::Add ? lhs + rhs
+                 : op == OpCode::Sub ? lhs - rhs
+                 : op == OpCode::Mul ? lhs * rhs
+                 : op == OpCode::Div ? lhs / rhs
+                 : -lhs;
+        }
+
+        constexpr auto IsDigit() const -> bool
+        {
+            return pos < input.size() && input[pos] >= '0' && input[pos] <= '9';
+        }
+
+        // term           → factor { ( "-" | "+" ) factor } ;
+
+        constexpr auto Term() -> Data_t
+        {
+            auto value = Factor();
+
+            for(;;)
+            {
+                if(Accept('+'))
+                {
+                    value = Apply(OpCode::Add, value, Factor());
+                }
+                else if(Accept('-'))
+                {
+                    value = Apply(OpCode::Sub, value, Factor());
+                }
+                else
+                {
+                    return value;
+                }
+            }
+        }
+
+        // factor         → unary { ( "/" | "*" ) unary } ;
+
+        constexpr auto Factor() -> Data_t
+        {
+            auto value = Unary();
+
+            for(;;)
+            {
+                if(Accept('*'))
+                {
+                    value = Apply(OpCode::Mul, value, Unary());
+                }
+                else if(Accept('/'))
+                {
+                    value = Apply(OpCode::Div, value, Unary());
+                }
+                else
+                {
+                    return value;
+                }
+            }
+        }
+
+        // unary          → "-" unary | primary ;
+
+        constexpr auto Unary() -> Data_t
+        {
+            if(Accept('-'))
+            {
+                return Apply(OpCode::Neg, Unary());
+            }
+
+            return Primary();
+        }
+
+        // primary        → number | "(" term ")" ;
+
+        constexpr auto Primary() -> Data_t
+        {
+            if(Accept('('))
+            {
+                const auto value = Term();
+
+                if(!Accept(')'))
+                {
+                    throw std::invalid_argument{"missing ')'"};
+                }
+
+                SkipSpaces();
+                return value;
+            }
+
+            SkipSpaces();
+            const auto value = Number();
+            emit.Push(value);
+            SkipSpaces();
+
+            return value;
+        }
+
+        // number         → digits [ "." [ digits ] ] [ exponent ] | "." digits [ exponent ] ;
+        // Exact, and equal to std::from_chars, when the decimal significand
+        // fits in 53 bits and 10^exponent is exact, |exponent| ≤ 22: then
+        // one multiplication or division rounds once. Other literals, once
+        // trailing zeros are moved into the exponent, are rejected.
+
+        constexpr auto Number() -> Data_t
+        {
+            std::uint64_t significand{};
+            int exponent{};
+            std::size_t digits{};
+            bool isInexact{};
+
+            const auto accumulate = [&](bool fraction)
+            {
+                for(; IsDigit(); ++pos, ++digits)
+                {
+                    if(significand < 1'000'000'000'000'000'000ULL)
+                    {
+                        significand = significand * 10U + static_cast<std::uint64_t>(input[pos] - '0');
+                        exponent -= fraction ? 1 : 0;
+                    }
+                    else
+                    {
+                        exponent += fraction ? 0 : 1;
+                        isInexact = isInexact || input[pos] != '0';
+                    }
+                }
+            };
+
+            accumulate(false);
+
+            if(pos < input.size() && input[pos] == '.')
+            {
+                ++pos;
+                accumulate(true);
+            }
+
+            if(digits == 0)
+            {
+                throw std::invalid_argument{"expected a number"};
+            }
+
+            if(pos < input.size() && (input[pos] == 'e' || input[pos] == 'E'))
+            {
+                ++pos;
+
+                const auto negative = pos < input.size() && input[pos] == '-';
+                pos += (negative || (pos < input.size() && input[pos] == '+')) ? 1U : 0U;
+
+                if(!IsDigit())
+                {
+                    throw std::invalid_argument{"expected an exponent"};
+                }
+
+                int e{};
+                for(; IsDigit(); ++pos)
+                {
+                    e = std::min(e * 10 + (input[pos] - '0'), 10'000);
+                }
+
+                exponent += negative ? -e : e;
+            }
+
+            constexpr std::uint64_t exactSignificand = std::uint64_t{1} << 53;
+            constexpr int exactExponent = 22;
+
+            if(isInexact)
+            {
+                throw std::invalid_argument{"literal has more significant digits than parsed exactly"};
+            }
+
+            for(; significand != 0 && significand % 10U == 0 && exponent < exactExponent; significand /= 10U)
+            {
+                ++exponent;
+            }
+
+            for(; significand != 0 && exponent > exactExponent && significand < exactSignificand / 10U; --exponent)
+            {
+                significand *= 10U;
+            }
+
+            if(significand == 0)
+            {
+                return 0.0;
+            }
+
+            if(significand > exactSignificand || exponent < -exactExponent || exponent > exactExponent)
+            {
+                throw std::invalid_argument{"literal outside the exactly parsed range"};
+            }
+
+            auto value = static_cast<Data_t>(significand);
+            Data_t scale = 1.0;
+
+            for(auto i = exponent < 0 ? -exponent : exponent; i > 0; --i)
+            {
+                scale *= 10.0;
+            }
+
+            return exponent < 0 ? value / scale : value * scale;
+        }
+
+        std::string_view input;
+        Emitter& emit;
+        bool isEvaluating;
+        std::size_t pos{};
+    };
+
+    // Code bytes and pool size.
+    template <Fixed_string Source, Fold F>
+    consteval auto chunk_size() -> std::pair<std::size_t, std::size_t>
+    {
+        Size_emitter e;
+        const auto value = Static_parser{Source.View(), e, F == Fold::Constant}.Parse();
+
+        if constexpr(F == Fold::Constant)
+        {
+            Size_emitter folded;
+            folded.Push(value);
+            folded.Op(OpCode::Return);
+            return {folded.size, folded.constants};
+        }
+        else
+        {
+            return {e.size, e.constants};
+        }
+    }
+}
+
+template <Fixed_string Source, Fold F = Fold::Constant>
+consteval auto compile_expr()
+{
+    constexpr auto size = detail::chunk_size<Source, F>();
+
+    Static_chunk<size.first, size.second> chunk;
+    detail::Code_emitter e{chunk.code, chunk.constants};
+
+    if constexpr(F == Fold::Constant)
+    {
+        detail::Size_emitter ignored;
+        chunk.value = detail::Static_parser{Source.View(), ignored}.Parse();
+        e.Push(chunk.value);
+        e.Op(OpCode::Return);
+    }
+    else
+    {
+        detail::Static_parser{Source.View(), e, false}.Parse();
+    }
+
+    return chunk;
+}
+
+static_assert(compile_expr<"1 + 2 * 3">().value == 7.0);
+static_assert(compile_expr<"-(2 - .5) / 4", Fold::None>().code.size() == 3 * 2 + 4);
+static_assert(compile_expr<"-(2 - .5) / 4", Fold::None>().constants.size() == 1);
+static_assert(compile_expr<"0.5 * 0.5 + 1 - 300 - 1e6", Fold::None>().constants.size() == 2);
+
+// Exact at the edges of the range, as the compiler parses the same literals.
+static_assert(compile_expr<"9007199254740992">().value == 9007199254740992.0);
+static_assert(compile_expr<"9007199254740991e22">().value == 9007199254740991e22);
+static_assert(compile_expr<"9007199254740991e-22">().value == 9007199254740991e-22);
+static_assert(compile_expr<"1e-22">().value == 1e-22);
+static_assert(compile_expr<"1e30">().value == 1e30);
+static_assert(compile_expr<"0.1">().value == 0.1);
+static_assert(compile_expr<"123.4560000000000000000000">().value == 123.456);
+static_assert(compile_expr<"0e-400">().value == 0.0);
+static_assert(compile_expr<"1 / 0", Fold::None>().code.size() == 2 * 1 + 2);
@@ -0,0 +1,406 @@
+#pragma once
+
+#include "Batch.hpp"
+#include "Compiler.hpp"
+
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+// Chunk files: a library of named compiled chunks, mapped and executed in
+// place. All offsets are from the start of the file.
+//
+//   header      magic, version, byte order, chunk count, file size, CRC-32
+//   index       one entry a chunk, sorted by name
+//   constants   every pool, 8-byte aligned
+//   code        every chunk's bytecode
+//   names       every name
+//
+// Sections start on `sectionAlignment` boundaries. Values are stored in the
+// writer's byte order, which the reader must share since nothing is copied;
+// the CRC covers everything after the header.
+
+inline constexpr std::array<char, 8> chunkFileMagic{'X', 'P', 'R', 'C', 'H', 'U', 'N', 'K'};
+inline constexpr std::uint16_t chunkFileVersion = 2;
+inline constexpr std::uint16_t chunkFileByteOrder = 0x0102;
+inline constexpr std::size_t sectionAlignment = 64;
+
+struct Chunk_file_header
+{
+    std::array<char, 8> magic;
+    std::uint16_t version;
+    std::uint16_t byteOrder;    // chunkFileByteOrder as written
+    std::uint32_t count;
+    std::uint64_t size;
+    std::uint32_t crc;
+    std::uint32_t reserved;
+};
+
+struct Chunk_file_entry
+{
+    std::uint64_t constants;
+    std::uint64_t code;
+    std::uint64_t name;
+    std::uint32_t constantCount;
+    std::uint32_t codeSize;
+    std::uint32_t nameSize;
+    std::uint32_t depth;        // maximum stack depth
+};
+
+static_assert(sizeof(Chunk_file_header) == 32 && sizeof(Chunk_file_entry) == 40);
+
+class Chunk_file_error : public std::runtime_error
+{
+public:
+
+    Chunk_file_error(const std::string& path, const std::string& what)
+        : std::runtime_error{path + ": " + what}
+    {
+    }
+};
+
+namespace detail
+{
+    // CRC-32 (IEEE 802.3) tables, to take eight bytes a step.
+    inline constexpr auto crcTables = []
+    {
+        std::array<std::array<std::uint32_t, 256>, 8> tables{};
+
+        for(std::uint32_t i = 0; i < 256; ++i)
+        {
+            auto c = i;
+
+            for(int k = 0; k < 8; ++k)
+            {
+                c = (c & 1U) != 0 ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            }
+
+            tables[0][i] = c;
+        }
+
+        for(std::size_t t = 1; t < 8; ++t)
+        {
+            for(std::size_t i = 0; i < 256; ++i)
+            {
+                tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFFU];
+            }
+        }
+
+        return tables;
+    }();
+}
+
+inline auto crc32(std::string_view bytes) -> std::uint32_t
+{
+    const auto& t = detail::crcTables;
+    auto crc = ~std::uint32_t{};
+    std::size_t i{};
+
+    for(; std::endian::native == std::endian::little && i + 8 <= bytes.size(); i += 8)
+    {
+        std::uint32_t lo{}, hi{};
+        std::memcpy(&lo, bytes.data() + i, 4);
+        std::memcpy(&hi, bytes.data() + i + 4, 4);
+
+        lo ^= crc;
+        crc = t[7][lo & 0xFFU] ^ t[6][(lo >> 8) & 0xFFU] ^ t[5][(lo >> 16) & 0xFFU] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xFFU] ^ t[2][(hi >> 8) & 0xFFU] ^ t[1][(hi >> 16) & 0xFFU] ^ t[0][hi >> 24];
+    }
+
+    for(; i < bytes.size(); ++i)
+    {
+        crc = t[0][(crc ^ static_cast<std::uint8_t>(bytes[i])) & 0xFFU] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+// Collects chunks by name, then lays the file out in one buffer.
+
+class Chunk_file_writer
+{
+public:
+
+    // False when `name` is already taken; the first chunk stays.
+    auto Add(std::string name, Chunk_view chunk) -> bool
+    {
+        return chunks.try_emplace(std::move(name), Chunk_t{{chunk.constants.begin(), chunk.constants.end()}, std::string{chunk.code}, chunk.depth}).second;
+    }
+
+    auto Size() const -> std::size_t
+    {
+        return chunks.size();
+    }
+
+    auto Image() const -> std::string
+    {
+        const auto align = [](std::size_t offset) { return (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment; };
+
+        constexpr auto limit = std::numeric_limits<std::uint32_t>::max();
+        std::size_t constants{}, code{}, names{};
+
+        for(const auto& [name, chunk] : chunks)
+        {
+            constants += chunk.constants.size() * sizeof(Data_t);
+            code += chunk.code.size();
+            names += name.size();
+
+            if(chunk.constants.size() > limit || chunk.code.size() > limit || chunk.depth > limit || name.size() > limit)
+            {
+                throw Chunk_file_error{name, "chunk too large"};
+            }
+        }
+
+        if(chunks.size() > limit)
+        {
+            throw Chunk_file_error{"chunk file", "too many chunks"};
+        }
+
+        const auto indexAt = align(sizeof(Chunk_file_header));
+        auto constantsAt = align(indexAt + chunks.size() * sizeof(Chunk_file_entry));
+        auto codeAt = align(constantsAt + constants);
+        auto namesAt = align(codeAt + code);
+
+        std::string image(namesAt + names, '\0');
+        auto* entry = image.data() + indexAt;
+
+        for(const auto& [name, chunk] : chunks)
+        {
+            const Chunk_file_entry e
+            {
+                constantsAt, codeAt, namesAt,
+                static_cast<std::uint32_t>(chunk.constants.size()),
+                static_cast<std::uint32_t>(chunk.code.size()),
+                static_cast<std::uint32_t>(name.size()),
+                static_cast<std::uint32_t>(chunk.depth),
+            };
+
+            std::memcpy(entry, &e, sizeof(e));
+            std::memcpy(image.data() + constantsAt, chunk.constants.data(), chunk.constants.size() * sizeof(Data_t));
+            std::memcpy(image.data() + codeAt, chunk.code.data(), chunk.code.size());
+            std::memcpy(image.data() + namesAt, name.data(), name.size());
+
+            entry += sizeof(e);
+            constantsAt += chunk.constants.size() * sizeof(Data_t);
+            codeAt += chunk.code.size();
+            namesAt += name.size();
+        }
+
+        const Chunk_file_header header
+        {
+            chunkFileMagic, chunkFileVersion, chunkFileByteOrder,
+            static_cast<std::uint32_t>(chunks.size()),
+            image.size(),
+            crc32(std::string_view{image}.substr(sizeof(Chunk_file_header))),
+            0,
+        };
+
+        std::memcpy(image.data(), &header, sizeof(header));
+        return image;
+    }
+
+    // The image is written in one piece, unbuffered; write and close errors
+    // are thrown.
+    void Write(const std::string& path) const
+    {
+        const auto image = Image();
+        const auto fd = Buffered_writer::Open(path);
+
+        try
+        {
+            write_all(fd, image);
+        }
+        catch(...)
+        {
+            ::close(fd);
+            throw;
+        }
+
+        if(::close(fd) < 0)
+        {
+            throw std::system_error{errno, std::generic_category(), path};
+        }
+    }
+
+private:
+
+    std::map<std::string, Chunk_t, std::less<>> chunks;
+};
+
+// A mapped chunk file: chunks are views into the mapping, valid as long as
+// the Chunk_file lives. Opening checks the header and the index only, the
+// CRC when `checkCrc` is set: the rest of the file is not read. Each chunk's
+// bytecode is verified the first time it is returned.
+
+class Chunk_file
+{
+public:
+
+    explicit Chunk_file(const std::string& path, bool checkCrc = false) : file{path}, bytes{file.View()}, filePath{path}
+    {
+        const auto fail = [&](const char* what) { throw Chunk_file_error{path, what}; };
+
+        if(bytes.size() < sizeof(Chunk_file_header))
+        {
+            fail("not a chunk file");
+        }
+
+        Chunk_file_header header;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+
+        if(header.magic != chunkFileMagic)
+        {
+            fail("not a chunk file");
+        }
+
+        if(header.byteOrder != chunkFileByteOrder)
+        {
+            fail("written with another byte order");
+        }
+
+        if(header.version != chunkFileVersion)
+        {
+            fail("unsupported version");
+        }
+
+        if(header.size != bytes.size())
+        {
+            fail("truncated");
+        }
+
+        count = header.count;
+        indexAt = (sizeof(Chunk_file_header) + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+
+        if(bytes.size() < indexAt || count > (bytes.size() - indexAt) / sizeof(Chunk_file_entry))
+        {
+            fail("index out of bounds");
+        }
+
+        if(checkCrc && crc32(bytes.substr(sizeof(Chunk_file_header))) != header.crc)
+        {
+            fail("CRC mismatch");
+        }
+
+        const auto within = [&](std::uint64_t offset, std::uint64_t length)
+        {
+            return offset <= bytes.size() && length <= bytes.size() - offset;
+        };
+
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            const auto e = Entry(i);
+
+            if(e.constants % alignof(Data_t) != 0
+               || !within(e.constants, std::uint64_t{e.constantCount} * sizeof(Data_t))
+               || !within(e.code, e.codeSize)
+               || !within(e.name, e.nameSize))
+            {
+                fail("chunk out of bounds");
+            }
+
+            // Find searches the names in order.
+            if(i > 0 && !(Name(i - 1) < Name(i)))
+            {
+                fail("index not sorted");
+            }
+        }
+
+        verified = std::make_unique<std::atomic<bool>[]>(count);
+    }
+
+    auto Size() const -> std::size_t
+    {
+        return count;
+    }
+
+    auto Name(std::size_t i) const -> std::string_view
+    {
+        const auto e = Entry(i);
+        return bytes.substr(e.name, e.nameSize);
+    }
+
+    // Throws Chunk_file_error when the chunk fails verification.
+    auto operator[](std::size_t i) const -> Verified_chunk
+    {
+        if(verified[i].load(std::memory_order_acquire))
+        {
+            return Verified_chunk{Raw(i)};
+        }
+
+        try
+        {
+            const auto chunk = ::verify(Raw(i));
+            verified[i].store(true, std::memory_order_release);
+            return chunk;
+        }
+        catch(const Bytecode_error& error)
+        {
+            throw Chunk_file_error{filePath, "chunk " + std::to_string(i) + ", " + error.what()};
+        }
+    }
+
+    // Binary search in the sorted index.
+    auto Find(std::string_view name) const -> std::optional<Verified_chunk>
+    {
+        std::size_t lo{}, hi{count};
+
+        while(lo < hi)
+        {
+            const auto mid = lo + (hi - lo) / 2;
+            const auto order = Name(mid).compare(name);
+
+            if(order == 0)
+            {
+                return (*this)[mid];
+            }
+
+            if(order < 0)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        return {};
+    }
+
+private:
+
+    auto Raw(std::size_t i) const -> Chunk_view
+    {
+        const auto e = Entry(i);
+        const auto* constants = reinterpret_cast<const Data_t*>(bytes.data() + e.constants);
+        return {{constants, e.constantCount}, bytes.substr(e.code, e.codeSize), e.depth};
+    }
+
+    auto Entry(std::size_t i) const -> Chunk_file_entry
+    {
+        Chunk_file_entry e;
+        std::memcpy(&e, bytes.data() + indexAt + i * sizeof(Chunk_file_entry), sizeof(e));
+        return e;
+    }
+
+    Mapped_file file;
+    std::string_view bytes;
+    std::size_t count{};
+    std::size_t indexAt{};
+    std::string filePath;
+    std::unique_ptr<std::atomic<bool>[]> verified;     // one flag an entry
+};
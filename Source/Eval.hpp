@@ -0,0 +1,282 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "FlatAst.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Iterative walkers: deep trees only grow heap-allocated work stacks, and
+// past `maxDepth` levels they throw Depth_error.
+
+// evalStack keeps the current value in a local: it walks down left spines
+// pushing pending operators, and climbs back up applying them. A pending
+// binary operator holds its left operand once the right one is under way.
+// `ast` sits `base` levels deep in the tree the limit applies to.
+
+inline auto evalStack(const Expr& ast, std::size_t maxDepth = defaultMaxDepth, std::size_t base = 0) -> Data_t
+{
+    struct Pending
+    {
+        const Expr* rhs;    // null once the left operand is known
+        Data_t lhs;
+        std::size_t op;
+    };
+
+    // Indexed rather than push_back/pop_back: growth is the rare case.
+    thread_local std::vector<Pending> stack(64);
+    auto* pending = stack.data();
+    auto capacity = stack.size();
+    const auto limit = maxDepth - std::min(base, maxDepth);
+    std::size_t depth{};
+
+    const Expr* node = &ast;
+    Data_t value{};
+
+    for(;;)
+    {
+        // <Data_t, Add, Sub, Mul, Div, Neg>
+        for(auto index = node->index(); index != 0; index = node->index())
+        {
+            if(depth >= limit)
+            {
+                throw Depth_error{maxDepth};
+            }
+
+            if(depth == capacity)
+            {
+                stack.resize(std::min(2 * depth, limit));
+                pending = stack.data();
+                capacity = stack.size();
+            }
+
+            const auto push = [&](const auto& b)
+            {
+                // A leaf on the left is read now and the walk goes right.
+                if(const auto* leaf = std::get_if<Data_t>(b.lhs.get()))
+                {
+                    pending[depth++] = {nullptr, *leaf, index};
+                    node = b.rhs.get();
+                }
+                else
+                {
+                    pending[depth++] = {b.rhs.get(), {}, index};
+                    node = b.lhs.get();
+                }
+            };
+
+            switch(index)
+            {
+                case 1: push(*std::get_if<Add>(node)); break;
+                case 2: push(*std::get_if<Sub>(node)); break;
+                case 3: push(*std::get_if<Mul>(node)); break;
+                case 4: push(*std::get_if<Div>(node)); break;
+                default:
+                    pending[depth++] = {nullptr, {}, index};
+                    node = std::get_if<Neg>(node)->expr.get();
+                    break;
+            }
+        }
+
+        value = *std::get_if<Data_t>(node);
+
+        for(;;)
+        {
+            if(depth == 0)
+            {
+                return value;
+            }
+
+            auto& top = pending[depth - 1];
+
+            auto lhs = top.lhs;
+
+            if(top.rhs != nullptr)
+            {
+                // A leaf on the right is applied in place, without descending.
+                if(const auto* leaf = std::get_if<Data_t>(top.rhs))
+                {
+                    lhs = value;
+                    value = *leaf;
+                }
+                else
+                {
+                    top.lhs = value;
+                    node = top.rhs;
+                    top.rhs = nullptr;
+                    break;
+                }
+            }
+
+            switch(top.op)
+            {
+                case 1: value = lhs + value; break;
+                case 2: value = lhs - value; break;
+                case 3: value = lhs * value; break;
+                case 4: value = lhs / value; break;
+                default: value = -value; break;
+            }
+
+            --depth;
+        }
+    }
+}
+
+// eval recurses natively for the first `nativeDepth` levels, where the
+// return stack predictor beats any work stack, and hands deeper subtrees to
+// evalStack. Native stack use is therefore bounded whatever the input.
+// Like post_order, it throws on an operator `maxDepth` levels down.
+
+inline constexpr std::size_t nativeDepth = 128;
+
+inline auto eval(const Expr& ast, std::size_t maxDepth = defaultMaxDepth, std::size_t depth = 0) -> Data_t
+{
+    if(depth >= maxDepth && !std::holds_alternative<Data_t>(ast))
+    {
+        throw Depth_error{maxDepth};
+    }
+
+    if(depth == nativeDepth)
+    {
+        return evalStack(ast, maxDepth, depth);
+    }
+
+    const auto next = [=](const Expr& e) { return eval(e, maxDepth, depth + 1); };
+
+    return std::visit(overloaded
+    {
+        [](Data_t value) { return value; },
+        [&](const Neg& n) { return -next(*n.expr); },
+        [&](const Mul& m) { return next(*m.lhs) * next(*m.rhs); },
+        [&](const Div& m) { return next(*m.lhs) / next(*m.rhs); },
+        [&](const Add& m) { return next(*m.lhs) + next(*m.rhs); },
+        [&](const Sub& m) { return next(*m.lhs) - next(*m.rhs); },
+    }, static_cast<const Variant_t&>(ast));
+}
+
+inline auto getDepth(const Expr& ast, std::size_t maxDepth = defaultMaxDepth) -> std::size_t
+{
+    std::size_t depth{};
+    post_order(ast, [&](const Expr&, std::size_t d) { depth = std::max(depth, d); }, maxDepth);
+    return depth;
+}
+
+inline void print(const Expr& ast, std::size_t maxDepth = defaultMaxDepth)
+{
+    struct ExprFmt
+    {
+        const Expr* e;
+        std::string prefix;
+        bool isLeft;
+        std::size_t depth;
+    };
+
+    const auto printNode = [](const std::string& pre, const std::string& symbol, bool left)
+    {
+        std::cout << pre;
+        std::cout << (left ? "├──" : "└──" );
+        std::cout << symbol << std::endl;
+    };
+
+    const auto printLeaf = [](const std::string& pre, bool left, const auto& value)
+    {
+        std::cout << pre << (left ? "├──🍁 " : "└──🍁 " ) << value << std::endl;
+    };
+
+    std::vector<ExprFmt> work{{&ast, "", false, 0}};
+
+    while(!work.empty())
+    {
+        const auto [e, prefix, isLeft, depth] = std::move(work.back());
+        work.pop_back();
+
+        if(depth >= maxDepth)
+        {
+            throw Depth_error{maxDepth};
+        }
+
+        const auto childPrefix = prefix + (isLeft ? "│   " : "    ");
+
+        // Right child first: the left one is popped, and printed, first.
+        const auto printChildren = [&](const std::string& symbol, const auto& b)
+        {
+            printNode(prefix, symbol, isLeft);
+            work.push_back({b.rhs.get(), childPrefix, false, depth + 1});
+            work.push_back({b.lhs.get(), childPrefix, true, depth + 1});
+        };
+
+        // <Data_t, Add, Sub, Mul, Div, Neg>
+        std::visit(overloaded
+        {
+            [&](Data_t value) 
+            { 
+                printLeaf(prefix, isLeft, value);
+            },
+            [&](const Neg& n) 
+            {
+                printNode(prefix, "➖", isLeft);
+                work.push_back({n.expr.get(), childPrefix, false, depth + 1});
+            },
+            [&](const Mul& m) { printChildren("✖", m); },
+            [&](const Div& m) { printChildren("➗", m); },
+            [&](const Add& m) { printChildren("➕", m); },
+            [&](const Sub& m) { printChildren("➖", m); },
+        }, static_cast<const Variant_t&>(*e));
+    }
+}
+
+inline void print(const Flat_ast& ast, std::size_t maxDepth = defaultMaxDepth)
+{
+    struct NodeFmt
+    {
+        Node_t node;
+        std::string prefix;
+        bool isLeft;
+        std::size_t depth;
+    };
+
+    std::vector<NodeFmt> work{{ast.Root(), "", false, 0}};
+
+    while(!work.empty())
+    {
+        const auto [node, prefix, isLeft, depth] = std::move(work.back());
+        work.pop_back();
+
+        if(depth >= maxDepth)
+        {
+            throw Depth_error{maxDepth};
+        }
+
+        const auto printNode = [&](const std::string& symbol)
+        {
+            std::cout << prefix << (isLeft ? "├──" : "└──" ) << symbol << std::endl;
+        };
+
+        const auto childPrefix = prefix + (isLeft ? "│   " : "    ");
+
+        const auto printChildren = [&](const std::string& symbol)
+        {
+            printNode(symbol);
+            work.push_back({ast.Rhs(node), childPrefix, false, depth + 1});
+            work.push_back({ast.Lhs(node), childPrefix, true, depth + 1});
+        };
+
+        switch(ast.Op(node))
+        {
+            case Node_op::Const:
+                std::cout << prefix << (isLeft ? "├──🍁 " : "└──🍁 " ) << ast.Value(node) << std::endl;
+                break;
+            case Node_op::Neg:
+                printNode("➖");
+                work.push_back({ast.Lhs(node), childPrefix, false, depth + 1});
+                break;
+            case Node_op::Mul: printChildren("✖"); break;
+            case Node_op::Div: printChildren("➗"); break;
+            case Node_op::Add: printChildren("➕"); break;
+            case Node_op::Sub: printChildren("➖"); break;
+        }
+    }
+}
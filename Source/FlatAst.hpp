@@ -0,0 +1,414 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "Compiler.hpp"
+#include "Parser.hpp"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Arena AST: nodes live in one struct-of-arrays and refer to each other by
+// 32-bit index. Nodes are appended in post-order, so every subtree occupies a
+// contiguous range ending at its root, children always come before their
+// parent and the root is the last node: eval and compile are linear scans.
+// Clear() frees every node at once and keeps the capacity for the next tree.
+
+using Node_t = std::uint32_t;
+
+enum class Node_op : std::uint8_t
+{
+    Const,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Neg,
+};
+
+class Flat_ast
+{
+public:
+
+    auto Constant(Data_t value) -> Node_t
+    {
+        constants.push_back(value);
+        return Append(Node_op::Const, static_cast<Node_t>(constants.size() - 1), 0);
+    }
+
+    auto Negate(Node_t operand) -> Node_t
+    {
+        return Append(Node_op::Neg, operand, 0);
+    }
+
+    auto Binary(Node_op op, Node_t lhs, Node_t rhs) -> Node_t
+    {
+        return Append(op, lhs, rhs);
+    }
+
+    // Drops every node appended after `mark` (a previous Size()), for parsers
+    // that backtrack.
+    void Rollback(Node_t mark)
+    {
+        while(Size() > mark)
+        {
+            if(ops.back() == Node_op::Const)
+            {
+                constants.pop_back();
+            }
+
+            ops.pop_back();
+            children.pop_back();
+        }
+    }
+
+    void Clear()
+    {
+        ops.clear();
+        children.clear();
+        constants.clear();
+    }
+
+    void Reserve(std::size_t nodes)
+    {
+        ops.reserve(nodes);
+        children.reserve(nodes);
+        constants.reserve(nodes / 2 + 1);
+    }
+
+    auto Size() const -> Node_t
+    {
+        return static_cast<Node_t>(ops.size());
+    }
+
+    // The last node appended; an empty arena has none.
+    auto Root() const -> Node_t
+    {
+        if(ops.empty())
+        {
+            throw std::out_of_range{"empty flat AST has no root"};
+        }
+
+        return Size() - 1;
+    }
+
+    auto Op(Node_t n) const -> Node_op
+    {
+        return ops[n];
+    }
+
+    auto Lhs(Node_t n) const -> Node_t
+    {
+        return children[n][0];
+    }
+
+    auto Rhs(Node_t n) const -> Node_t
+    {
+        return children[n][1];
+    }
+
+    auto Value(Node_t n) const -> Data_t
+    {
+        return constants[children[n][0]];
+    }
+
+    auto Constants() const -> std::size_t
+    {
+        return constants.size();
+    }
+
+private:
+
+    auto Append(Node_op op, Node_t lhs, Node_t rhs) -> Node_t
+    {
+        ops.push_back(op);
+        children.push_back({lhs, rhs});
+        return Size() - 1;
+    }
+
+    std::vector<Node_op> ops;
+    std::vector<std::array<Node_t, 2>> children;   // Const: index in constants
+    std::vector<Data_t> constants;
+};
+
+// Hash-consing node factory: structurally identical subtrees are interned,
+// so `ast` becomes a DAG where each distinct subexpression exists once.
+// Children still come before their parents (eval works unchanged), but a
+// shared node is no longer a contiguous subtree: compile it with compile_cse.
+
+class Hash_consing
+{
+public:
+
+    explicit Hash_consing(Flat_ast& a) : ast{a} {}
+
+    auto Constant(Data_t value) -> Node_t
+    {
+        return Intern({Node_op::Const, 0, 0, std::bit_cast<std::uint64_t>(value)}, [&]{ return ast.Constant(value); });
+    }
+
+    auto Negate(Node_t operand) -> Node_t
+    {
+        return Intern({Node_op::Neg, operand, 0, 0}, [&]{ return ast.Negate(operand); });
+    }
+
+    auto Binary(Node_op op, Node_t lhs, Node_t rhs) -> Node_t
+    {
+        return Intern({op, lhs, rhs, 0}, [&]{ return ast.Binary(op, lhs, rhs); });
+    }
+
+    // Forgets the nodes from `mark` on, through the log of interned keys:
+    // the cost is in the nodes dropped, not in the nodes kept.
+    void Rollback(Node_t mark)
+    {
+        for(; !interned.empty() && interned.back().second >= mark; interned.pop_back())
+        {
+            nodes.erase(interned.back().first);
+        }
+
+        ast.Rollback(mark);
+    }
+
+    void Clear()
+    {
+        nodes.clear();
+        interned.clear();
+        ast.Clear();
+        requested = 0;
+    }
+
+    auto Size() const -> Node_t
+    {
+        return ast.Size();
+    }
+
+    // Nodes asked for, against ast.Size() nodes actually stored.
+    auto Requested() const -> std::size_t
+    {
+        return requested;
+    }
+
+private:
+
+    struct Key
+    {
+        Node_op op;
+        Node_t lhs, rhs;
+        std::uint64_t bits;     // Const: the value
+
+        auto operator==(const Key&) const -> bool = default;
+    };
+
+    struct Key_hash
+    {
+        auto operator()(const Key& k) const -> std::size_t
+        {
+            auto h = static_cast<std::uint64_t>(k.op);
+            h = (h ^ k.lhs) * 0x9E3779B97F4A7C15ULL;
+            h = (h ^ k.rhs) * 0x9E3779B97F4A7C15ULL;
+            h = (h ^ k.bits) * 0x9E3779B97F4A7C15ULL;
+            return static_cast<std::size_t>(h ^ (h >> 32));
+        }
+    };
+
+    auto Intern(const Key& key, auto make) -> Node_t
+    {
+        ++requested;
+
+        const auto [it, inserted] = nodes.try_emplace(key, 0);
+
+        if(inserted)
+        {
+            it->second = make();
+            interned.emplace_back(key, it->second);
+        }
+
+        return it->second;
+    }
+
+    Flat_ast& ast;
+    std::unordered_map<Key, Node_t, Key_hash> nodes;
+    std::vector<std::pair<Key, Node_t>> interned;      // in node order
+    std::size_t requested{};
+};
+
+// Appends the tree `ast` in post-order to `flat` (a Flat_ast or a
+// Hash_consing factory), returns its root.
+
+inline auto flatten(const Expr& ast, auto& flat) -> Node_t
+{
+    std::vector<Node_t> nodes;
+
+    const auto pop = [&]
+    {
+        const auto n = nodes.back();
+        nodes.pop_back();
+        return n;
+    };
+
+    const auto binary = [&](Node_op op)
+    {
+        const auto rhs = pop();
+        const auto lhs = pop();
+        return flat.Binary(op, lhs, rhs);
+    };
+
+    post_order(ast, [&](const Expr& e, std::size_t)
+    {
+        nodes.push_back(std::visit(overloaded
+        {
+            [&](Data_t value) { return flat.Constant(value); },
+            [&](const Neg&) { return flat.Negate(pop()); },
+            [&](const Add&) { return binary(Node_op::Add); },
+            [&](const Sub&) { return binary(Node_op::Sub); },
+            [&](const Mul&) { return binary(Node_op::Mul); },
+            [&](const Div&) { return binary(Node_op::Div); },
+        }, static_cast<const Variant_t&>(e)));
+    });
+
+    return nodes.back();
+}
+
+// Children come first, so one forward pass evaluates every node.
+
+inline auto eval(const Flat_ast& ast) -> Data_t
+{
+    thread_local std::vector<Data_t> values;
+    values.resize(ast.Size());
+
+    for(Node_t n = 0; n < ast.Size(); ++n)
+    {
+        switch(ast.Op(n))
+        {
+            case Node_op::Const: values[n] = ast.Value(n); break;
+            case Node_op::Neg: values[n] = -values[ast.Lhs(n)]; break;
+            case Node_op::Add: values[n] = values[ast.Lhs(n)] + values[ast.Rhs(n)]; break;
+            case Node_op::Sub: values[n] = values[ast.Lhs(n)] - values[ast.Rhs(n)]; break;
+            case Node_op::Mul: values[n] = values[ast.Lhs(n)] * values[ast.Rhs(n)]; break;
+            case Node_op::Div: values[n] = values[ast.Lhs(n)] / values[ast.Rhs(n)]; break;
+        }
+    }
+
+    return values[ast.Root()];
+}
+
+// Post-order is stack machine order: one instruction per node.
+
+inline auto compile(const Flat_ast& ast) -> Chunk_t
+{
+    static constexpr std::array codes
+    {
+        OpCode::NoOp, OpCode::Add, OpCode::Sub, OpCode::Mul, OpCode::Div, OpCode::Neg,
+    };
+
+    Chunk_builder chunk{ast.Size() + ast.Constants() + 1};
+
+    for(Node_t n = 0; n < ast.Size(); ++n)
+    {
+        if(ast.Op(n) == Node_op::Const)
+        {
+            chunk.Push(ast.Value(n));
+        }
+        else
+        {
+            chunk.Emit(codes[static_cast<std::size_t>(ast.Op(n))]);
+        }
+    }
+
+    return chunk.Finish();
+}
+
+// DAG compiler, common subexpressions are computed once: the first time a
+// shared node is computed its value is stored in a slot (Store keeps it on
+// the stack), later uses Load it back. Constants are pushed again, as a Push
+// is no dearer than a Load. Iterative, from the root (the last node).
+
+inline auto compile_cse(const Flat_ast& ast) -> Chunk_t
+{
+    constexpr auto noSlot = ~Slot_t{};
+
+    const auto root = ast.Root();
+
+    std::vector<std::uint32_t> uses(ast.Size());
+    std::vector<Slot_t> slots(ast.Size(), noSlot);
+    Slot_t nextSlot{};
+
+    uses[root] = 1;
+
+    for(Node_t n = 0; n < ast.Size(); ++n)
+    {
+        switch(ast.Op(n))
+        {
+            case Node_op::Const: break;
+            case Node_op::Neg: ++uses[ast.Lhs(n)]; break;
+            default: ++uses[ast.Lhs(n)]; ++uses[ast.Rhs(n)]; break;
+        }
+    }
+
+    static constexpr std::array codes
+    {
+        OpCode::NoOp, OpCode::Add, OpCode::Sub, OpCode::Mul, OpCode::Div, OpCode::Neg,
+    };
+
+    Chunk_builder chunk{ast.Size() * 2 + 1};
+
+    struct Work
+    {
+        Node_t node;
+        bool expanded;
+    };
+
+    std::vector<Work> work{{root, false}};
+
+    while(!work.empty())
+    {
+        const auto [n, expanded] = work.back();
+        work.pop_back();
+
+        const auto op = ast.Op(n);
+
+        if(slots[n] != noSlot)
+        {
+            chunk.Emit(OpCode::Load, slots[n]);
+        }
+        else if(op == Node_op::Const)
+        {
+            chunk.Push(ast.Value(n));
+        }
+        else if(!expanded)
+        {
+            work.push_back({n, true});
+
+            if(op != Node_op::Neg)
+            {
+                work.push_back({ast.Rhs(n), false});
+            }
+
+            work.push_back({ast.Lhs(n), false});
+        }
+        else
+        {
+            chunk.Emit(codes[static_cast<std::size_t>(op)]);
+
+            if(uses[n] > 1)
+            {
+                slots[n] = nextSlot++;
+                chunk.Emit(OpCode::Store, slots[n]);
+            }
+        }
+    }
+
+    return chunk.Finish();
+}
+
+// Pratt front end building into `ast` (cleared first): the root and the
+// unparsed input.
+
+auto pratt(std::string_view input, Flat_ast& ast) -> Parsed_t<Node_t>;
+auto pratt(std::string_view input, Hash_consing& ast) -> Parsed_t<Node_t>;
@@ -0,0 +1,362 @@
+#pragma once
+
+#include "Compiler.hpp"
+#include "Threaded.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// x86-64 backend: a verified chunk becomes straight-line SSE2 code. Stack
+// position i lives in xmm<i> up to `nbRegisters`, deeper positions are
+// spilled to memory, xmm13-15 are scratch. Constants, slots and spills sit
+// in a data block the code addresses through rax, loaded by the prologue,
+// so the entry point takes no argument: `double(*)()`.
+//
+// The code is written to a private anonymous mapping, then turned from
+// read/write to read/execute before it is first called, never both (W^X).
+// Fma needs FMA3. Where the backend is unavailable, on another target, when
+// mapping fails or the CPU lacks an instruction, Run() interprets the chunk
+// with Threaded.
+//
+// Not reentrant: the data block's slots and spills, like Threaded's stack,
+// are shared by every call, so two threads running the same Jit corrupt
+// each other's results. Build one Jit per thread; the Program_t it comes
+// from can be shared.
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define INTERPRETER_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define INTERPRETER_JIT 0
+#endif
+
+class Jit
+{
+public:
+
+    using Entry_t = double(*)();
+
+    static_assert(std::is_same_v<Data_t, double>, "the x86-64 backend computes in doubles");
+
+    explicit Jit(Verified_chunk chunk)
+    {
+#if INTERPRETER_JIT
+        if(Assemble(chunk))
+        {
+            return;
+        }
+#endif
+        fallback.emplace(chunk);
+    }
+
+    Jit(const Jit&) = delete;
+    auto operator=(const Jit&) -> Jit& = delete;
+
+    Jit(Jit&& other) noexcept
+        : data{std::move(other.data)}, fallback{std::move(other.fallback)},
+          entry{std::exchange(other.entry, nullptr)}, page{std::exchange(other.page, nullptr)}, pageSize{other.pageSize}, codeSize{other.codeSize}
+    {
+    }
+
+    auto operator=(Jit&&) -> Jit& = delete;
+
+    ~Jit()
+    {
+#if INTERPRETER_JIT
+        if(page != nullptr)
+        {
+            munmap(page, pageSize);
+        }
+#endif
+    }
+
+    auto Run() -> Data_t
+    {
+        return entry != nullptr ? entry() : fallback->Run();
+    }
+
+    // Native code, null when interpreting. Valid as long as the Jit lives.
+    auto Entry() const -> Entry_t
+    {
+        return entry;
+    }
+
+    auto IsNative() const -> bool
+    {
+        return entry != nullptr;
+    }
+
+    // Bytes of machine code.
+    auto CodeSize() const -> std::size_t
+    {
+        return codeSize;
+    }
+
+private:
+
+#if INTERPRETER_JIT
+    static constexpr std::uint8_t nbRegisters = 13;
+    static constexpr std::uint8_t scratchA = 13, scratchB = 14, scratchC = 15;
+
+    // Emits `prefix [REX] 0F op` followed by a register/register ModRM.
+    static void Sse(std::vector<std::uint8_t>& out, std::uint8_t prefix, std::uint8_t op, std::uint8_t reg, std::uint8_t rm)
+    {
+        out.push_back(prefix);
+
+        if(reg >= 8 || rm >= 8)
+        {
+            out.push_back(static_cast<std::uint8_t>(0x40 | (reg >> 3) << 2 | rm >> 3));
+        }
+
+        out.insert(out.end(), {0x0F, op, static_cast<std::uint8_t>(0xC0 | (reg & 7) << 3 | (rm & 7))});
+    }
+
+    // Same with the operand at [rax + 8 * index].
+    static void SseMemory(std::vector<std::uint8_t>& out, std::uint8_t prefix, std::uint8_t op, std::uint8_t reg, std::size_t index)
+    {
+        out.push_back(prefix);
+
+        if(reg >= 8)
+        {
+            out.push_back(0x44);
+        }
+
+        out.insert(out.end(), {0x0F, op, static_cast<std::uint8_t>(0x80 | (reg & 7) << 3)});
+
+        const auto displacement = static_cast<std::uint32_t>(index * sizeof(Data_t));
+
+        for(unsigned shift = 0; shift < 32; shift += 8)
+        {
+            out.push_back(static_cast<std::uint8_t>(displacement >> shift));
+        }
+    }
+
+    auto Assemble(Chunk_view chunk) -> bool
+    {
+        constexpr std::uint8_t movsd = 0x10, store = 0x11, addsd = 0x58, mulsd = 0x59, subsd = 0x5C, divsd = 0x5E, xorpd = 0x57;
+        constexpr std::uint8_t sd = 0xF2, pd = 0x66;     // scalar and packed double prefixes
+
+        const auto hasFma = __builtin_cpu_supports("fma") != 0;
+
+        // Data block: sign mask, then constants, slots and spills. Slot and
+        // spill offsets are only known once the whole chunk has been read.
+        std::vector<Data_t> constants;
+        std::vector<std::pair<std::size_t, std::size_t>> slotFixups, spillFixups;
+        std::size_t depth{}, maxDepth{}, slotCount{};
+
+        std::vector<std::uint8_t> code;
+        code.reserve(chunk.code.size() * 8 + 16);
+
+        // mov rax, imm64, patched once the data block is allocated.
+        code.insert(code.end(), {0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0});
+
+        const auto memory = [&](std::uint8_t prefix, std::uint8_t op, std::uint8_t reg, std::size_t index, auto& fixups)
+        {
+            SseMemory(code, prefix, op, reg, 0);
+            fixups.emplace_back(code.size() - 4, index);
+        };
+
+        const auto constant = [&](std::uint8_t op, std::uint8_t reg, Data_t value)
+        {
+            constants.push_back(value);
+            SseMemory(code, sd, op, reg, constants.size());     // index 0 is the sign mask
+        };
+
+        // Register holding stack position `pos`, loaded into `scratch` when spilled.
+        const auto use = [&](std::size_t pos, std::uint8_t scratch)
+        {
+            if(pos < nbRegisters)
+            {
+                return static_cast<std::uint8_t>(pos);
+            }
+
+            memory(sd, movsd, scratch, pos - nbRegisters, spillFixups);
+            return scratch;
+        };
+
+        const auto target = [&](std::size_t pos, std::uint8_t scratch)
+        {
+            return pos < nbRegisters ? static_cast<std::uint8_t>(pos) : scratch;
+        };
+
+        // Writes `reg` back to position `pos` when it is spilled.
+        const auto settle = [&](std::size_t pos, std::uint8_t reg)
+        {
+            if(pos >= nbRegisters)
+            {
+                memory(sd, store, reg, pos - nbRegisters, spillFixups);
+            }
+        };
+
+        const auto arithmetic = [](std::byte op)
+        {
+            return op == OpCode::Add ? addsd : op == OpCode::Sub ? subsd : op == OpCode::Mul ? mulsd : divsd;
+        };
+
+        for(std::size_t pos = 0; pos < chunk.code.size();)
+        {
+            const auto op = decode(chunk, pos);
+            pos += op.size;
+
+            if(is_push(op.code) || op.code == OpCode::Load)
+            {
+                const auto reg = target(depth, scratchA);
+
+                if(op.code == OpCode::Load)
+                {
+                    memory(sd, movsd, reg, op.slot, slotFixups);
+                    slotCount = std::max<std::size_t>(slotCount, op.slot + 1U);
+                }
+                else
+                {
+                    constant(movsd, reg, op.value);
+                }
+
+                settle(depth, reg);
+                maxDepth = std::max(maxDepth, ++depth);
+            }
+            else if(op.code == OpCode::Store)
+            {
+                memory(sd, store, use(depth - 1, scratchA), op.slot, slotFixups);
+                slotCount = std::max<std::size_t>(slotCount, op.slot + 1U);
+            }
+            else if(op.code == OpCode::Neg)
+            {
+                const auto reg = use(depth - 1, scratchA);
+                SseMemory(code, sd, movsd, scratchC, 0);
+                Sse(code, pd, xorpd, reg, scratchC);
+                settle(depth - 1, reg);
+            }
+            else if(op.code == OpCode::AddImm)
+            {
+                const auto reg = use(depth - 1, scratchA);
+                constant(movsd, scratchB, op.value);
+                Sse(code, sd, addsd, reg, scratchB);
+                settle(depth - 1, reg);
+            }
+            else if(op.code == OpCode::Fma)
+            {
+                if(!hasFma)
+                {
+                    return false;
+                }
+
+                const auto a = use(depth - 3, scratchA);
+                const auto b = use(depth - 2, scratchB);
+                const auto c = use(depth - 1, scratchC);
+
+                // vfmadd231sd c, a, b: c = a * b + c
+                code.insert(code.end(),
+                {
+                    0xC4,
+                    static_cast<std::uint8_t>((c < 8 ? 0x80 : 0) | 0x40 | (b < 8 ? 0x20 : 0) | 0x02),
+                    static_cast<std::uint8_t>(0x80 | (~a & 0xF) << 3 | 0x01),
+                    0xB9,
+                    static_cast<std::uint8_t>(0xC0 | (c & 7) << 3 | (b & 7)),
+                });
+
+                depth -= 2;
+
+                if(depth - 1 < nbRegisters)
+                {
+                    Sse(code, sd, movsd, static_cast<std::uint8_t>(depth - 1), c);
+                }
+                else
+                {
+                    settle(depth - 1, c);
+                }
+            }
+            else if(op.code == OpCode::Add || op.code == OpCode::Sub || op.code == OpCode::Mul || op.code == OpCode::Div)
+            {
+                const auto lhs = use(depth - 2, scratchA);
+                const auto rhs = use(depth - 1, scratchB);
+                Sse(code, sd, arithmetic(op.code), lhs, rhs);
+                settle(depth - 2, lhs);
+                --depth;
+            }
+            else if(op.code == OpCode::Return)
+            {
+                break;
+            }
+        }
+
+        if(depth != 1)
+        {
+            return false;
+        }
+
+        code.push_back(0xC3);    // ret, the result is already in xmm0
+
+        // Sign mask, constants, slots, spills.
+        const auto slotBase = 1 + constants.size();
+        const auto spillBase = slotBase + slotCount;
+        const auto spills = maxDepth > nbRegisters ? maxDepth - nbRegisters : 0;
+
+        if((spillBase + spills) * sizeof(Data_t) > 0x7FFF'FFFFU)
+        {
+            return false;
+        }
+
+        data.assign(spillBase + spills, Data_t{});
+        data[0] = -0.0;
+        std::copy(constants.begin(), constants.end(), data.begin() + 1);
+
+        const auto patch = [&](std::size_t at, std::size_t index)
+        {
+            const auto displacement = static_cast<std::uint32_t>(index * sizeof(Data_t));
+            std::memcpy(code.data() + at, &displacement, sizeof(displacement));
+        };
+
+        for(const auto& [at, index] : slotFixups)
+        {
+            patch(at, slotBase + index);
+        }
+
+        for(const auto& [at, index] : spillFixups)
+        {
+            patch(at, spillBase + index);
+        }
+
+        const auto address = reinterpret_cast<std::uintptr_t>(data.data());
+        std::memcpy(code.data() + 2, &address, sizeof(address));
+
+        const auto pageBytes = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const auto size = (code.size() + pageBytes - 1) / pageBytes * pageBytes;
+
+        auto* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if(mapped == MAP_FAILED)
+        {
+            return false;
+        }
+
+        std::memcpy(mapped, code.data(), code.size());
+
+        if(mprotect(mapped, size, PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(mapped, size);
+            return false;
+        }
+
+        page = mapped;
+        pageSize = size;
+        codeSize = code.size();
+        entry = reinterpret_cast<Entry_t>(mapped);
+        return true;
+    }
+#endif
+
+    std::vector<Data_t> data;
+    std::optional<Threaded> fallback;
+    Entry_t entry{};
+    void* page{};
+    std::size_t pageSize{};
+    std::size_t codeSize{};
+};
@@ -0,0 +1,64 @@
+#include "Lexer.hpp"
+#include "Parser.hpp"
+
+#include <cstdint>
+#include <limits>
+
+void lex(std::string_view input, Tokens_t& tokens)
+{
+    tokens.clear();
+
+    // Offsets are 32-bit.
+    if(input.size() > std::numeric_limits<std::uint32_t>::max())
+    {
+        tokens.push_back({0, 0, Token_kind::Error});
+        return;
+    }
+
+    std::size_t pos = space_run(input);
+
+    const auto push = [&](Token_kind kind, double value = 0)
+    {
+        tokens.push_back({value, static_cast<std::uint32_t>(pos), kind});
+    };
+
+    while(pos < input.size())
+    {
+        const auto c = input[pos];
+
+        if((c >= '0' && c <= '9') || c == '.')
+        {
+            const auto literal = number(input.substr(pos));
+
+            if(!literal)
+            {
+                push(Token_kind::Error);
+                return;
+            }
+
+            push(Token_kind::Number, literal->first);
+            pos = input.size() - literal->second.size();
+        }
+        else
+        {
+            switch(c)
+            {
+                case '+': push(Token_kind::Plus); break;
+                case '-': push(Token_kind::Minus); break;
+                case '*': push(Token_kind::Star); break;
+                case '/': push(Token_kind::Slash); break;
+                case '(': push(Token_kind::LeftParen); break;
+                case ')': push(Token_kind::RightParen); break;
+                default:
+                    push(Token_kind::Error);
+                    return;
+            }
+
+            ++pos;
+        }
+
+        pos += space_run(input.substr(pos));
+    }
+
+    push(Token_kind::End);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Tokenizer stage: turns the input into a flat token array in one pass, so
+// parsers look at tokens instead of characters and whitespace.
+
+enum class Token_kind : std::uint8_t
+{
+    Number,
+    Plus,
+    Minus,
+    Star,
+    Slash,
+    LeftParen,
+    RightParen,
+    End,        // end of input
+    Error,      // first character that starts no token; lexing stops there
+};
+
+struct Token
+{
+    double value;           // Number only
+    std::uint32_t offset;   // in the input
+    Token_kind kind;
+};
+
+using Tokens_t = std::vector<Token>;
+
+// Length of the leading run of whitespace (" \t\n\v\f\r"), classified 32 (AVX2)
+// or 16 (SSE2) bytes at a time.
+
+inline auto space_run(std::string_view input) -> std::size_t
+{
+    std::size_t n = 0;
+
+#if defined(__AVX2__)
+    for(; n + 32 <= input.size(); n += 32)
+    {
+        const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input.data() + n));
+        const auto blank = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' '));
+        // '\t'..'\r' are 9..13: subtract 9 and keep what is still below 5
+        const auto shifted = _mm256_sub_epi8(block, _mm256_set1_epi8(9));
+        const auto control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+        const auto spaces = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(blank, control)));
+
+        if(spaces != 0xFFFFFFFFU)
+        {
+            return n + static_cast<std::size_t>(std::countr_one(spaces));
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    for(; n + 16 <= input.size(); n += 16)
+    {
+        const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input.data() + n));
+        const auto blank = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+        const auto shifted = _mm_sub_epi8(block, _mm_set1_epi8(9));
+        const auto control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+        const auto spaces = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_or_si128(blank, control)));
+
+        if(spaces != 0xFFFFU)
+        {
+            return n + static_cast<std::size_t>(std::countr_one(spaces));
+        }
+    }
+#endif
+
+    while(n < input.size() && (input[n] == ' ' || (input[n] >= '\t' && input[n] <= '\r')))
+    {
+        ++n;
+    }
+
+    return n;
+}
+
+// Lexes `input` into `tokens` (cleared first, so one buffer can be reused).
+// The array always ends with an End or an Error token; input longer than a
+// 32-bit offset reaches is a single Error token.
+
+void lex(std::string_view input, Tokens_t& tokens);
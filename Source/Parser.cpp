@@ -8,144 +8,217 @@
 
 using namespace std::string_literals;
 
-// expression     → term ;
-
-auto expression(std::string_view input) -> Parsed
+namespace
 {
-    return term(input);
-}
+    // The grammar, once plain and once with every rule but expression going
+    // through memo(), for packrat: inside its Memo_scope each memoized rule
+    // runs at most once per input offset. The plain grammar pays nothing for
+    // the memoized one.
 
-// term           → factor { ( "-" | "+" ) factor } ;
-
-auto term(std::string_view input) -> Parsed
-{
-    return sequence
-    (
-        [] (auto f, auto vsf) 
+    template <bool isMemoized>
+    struct Grammar
+    {
+        // Calls `body` through one memo a rule when memoized.
+        template <auto body>
+        static auto Rule(std::string_view input) -> Parsed
         {
-            return std::accumulate(vsf.begin(), vsf.end(), f, [](const auto& acc, const auto& v)
+            if constexpr(isMemoized)
+            {
+                static const memo rule = body;
+                return rule(input);
+            }
+            else
             {
-                return v.first == '-' ? MakeExpr<Sub>(acc, v.second) : MakeExpr<Add>(acc, v.second);
-            });
-        },
-        factor,
-        repeat
-        (
-            sequence
+                return body(input);
+            }
+        }
+
+        // expression     → term ;
+
+        static auto Expression(std::string_view input) -> Parsed
+        {
+            return Term(input);
+        }
+
+        // term           → factor { ( "-" | "+" ) factor } ;
+
+        static auto Term(std::string_view input) -> Parsed
+        {
+            return Rule<&TermBody>(input);
+        }
+
+        static auto TermBody(std::string_view in) -> Parsed
+        {
+            return sequence
             (
-                [] (auto s, auto f) { return std::pair{s, f}; },
-                either
+                [] (auto f, auto vsf) 
+                {
+                    return std::accumulate(vsf.begin(), vsf.end(), std::move(f), [](auto acc, auto& v)
+                    {
+                        return v.first == '-' ? MakeExpr<Sub>(std::move(acc), std::move(v.second)) 
+                                              : MakeExpr<Add>(std::move(acc), std::move(v.second));
+                    });
+                },
+                Factor,
+                repeat
                 (
-                    symbol('-'),
-                    symbol('+')
-                ),
-                factor
-            )
-        )
-    )(input);
-}
+                    sequence
+                    (
+                        [] (auto s, auto f) { return std::pair{s, std::move(f)}; },
+                        either
+                        (
+                            symbol('-'),
+                            symbol('+')
+                        ),
+                        Factor
+                    )
+                )
+            )(in);
+        }
 
-// factor         → unary { ( "/" | "*" ) unary } ;
+        // factor         → unary { ( "/" | "*" ) unary } ;
 
-auto factor(std::string_view input) -> Parsed
-{
-    return sequence
-    (
-        [] (auto u, auto vsu) 
+        static auto Factor(std::string_view input) -> Parsed
+        {
+            return Rule<&FactorBody>(input);
+        }
+
+        static auto FactorBody(std::string_view in) -> Parsed
+        {
+            return sequence
+            (
+                [] (auto u, auto vsu) 
+                {
+                    return std::accumulate(vsu.begin(), vsu.end(), std::move(u), [](auto acc, auto& v)
+                    {
+                        return v.first == '/' ? MakeExpr<Div>(std::move(acc), std::move(v.second)) 
+                                              : MakeExpr<Mul>(std::move(acc), std::move(v.second));
+                    });
+                },
+                Unary,
+                repeat
+                (
+                    sequence
+                    (
+                        [] (auto s, auto u) { return std::pair{s, std::move(u)}; },
+                        either
+                        (
+                            symbol('/'),
+                            symbol('*')
+                        ),
+                        Unary
+                    )
+                )
+            )(in);
+        }
+
+        // unary          → ( "!" | "-" ) unary | primary ;
+
+        static auto Unary(std::string_view input) -> Parsed
+        {
+            return Rule<&UnaryBody>(input);
+        }
+
+        // Iterative: count the leading "-" then wrap the primary.
+        static auto UnaryBody(std::string_view in) -> Parsed
         {
-            return std::accumulate(vsu.begin(), vsu.end(), u, [](const auto& acc, const auto& v)
+            std::size_t negations{};
+            auto rest = in;
+
+            while(const auto minus = symbol('-')(rest))
             {
-                return v.first == '/' ? MakeExpr<Div>(acc, v.second) : MakeExpr<Mul>(acc, v.second);
-            });
-        },
-        unary,
-        repeat
-        (
-            sequence
+                ++negations;
+                rest = minus->second;
+            }
+
+            auto parsed = Primary(rest);
+
+            for(; parsed && negations > 0; --negations)
+            {
+                parsed->first = MakeExpr<Neg>(std::move(parsed->first));
+            }
+
+            return parsed;
+        }
+
+        // primary        → real | integer | "(" expression ")" ;
+
+        static auto Primary(std::string_view input) -> Parsed
+        {
+            return Rule<&PrimaryBody>(input);
+        }
+
+        static auto PrimaryBody(std::string_view in) -> Parsed
+        {
+            return token
             (
-                [] (auto s, auto u) { return std::pair{s, u}; },
                 either
                 (
-                    symbol('/'),
-                    symbol('*')
-                ),
-                unary
-            )
-        )
-    )(input);
+                    real,
+                    chain(integer, [](auto i) { return unit(Expr{i}); }),
+                    sequence
+                    (
+                        [] (auto, auto e, auto) { return e;},
+                        symbol('('),
+                        [](std::string_view nested) -> Parsed
+                        {
+                            const Nesting_guard guard;
+                            return Expression(nested);
+                        },
+                        symbol(')')
+                    )
+                )
+            )(in);
+        }
+    };
+
+    using Plain = Grammar<false>;
+    using Memoized = Grammar<true>;
 }
 
-// unary          → ( "!" | "-" ) unary | primary ;
+auto expression(std::string_view input) -> Parsed
+{
+    return Plain::Expression(input);
+}
 
-auto unary(std::string_view input) -> Parsed
+auto term(std::string_view input) -> Parsed
 {
-    return either
-    (
-        sequence
-        (
-            [] (auto, auto u)
-            {
-                    return MakeExpr<Neg>(u);
-            },
-            symbol('-'),
-            unary
-        ),
-        primary
-    )(input);
+    return Plain::Term(input);
 }
 
-// primary        → real | integer | "(" expression ")" ;
+auto factor(std::string_view input) -> Parsed
+{
+    return Plain::Factor(input);
+}
+
+auto unary(std::string_view input) -> Parsed
+{
+    return Plain::Unary(input);
+}
 
 auto primary(std::string_view input) -> Parsed
 {
-    return token
-    (
-        either
-        (
-            real,
-            chain(integer, [](auto i) { return unit(Expr{i}); }),
-            sequence
-            (
-                [] (auto, auto e, auto) { return e;},
-                symbol('('),
-                expression,
-                symbol(')')
-            )
-        )
-    )(input);
+    return Plain::Primary(input);
 }
 
-// real = integer "." [integer] | "." integer.
+// real           → number ;
+
 auto real(std::string_view input) -> Parsed
 {
-    return sequence
-    (
-        [](auto v)
-        {
-            return Expr{v};
-        },
-        either
-        (
-            sequence
-            (
-                [](auto i, auto, auto f)
-                {
+    return chain(number, [](auto v) { return unit(Expr{v}); })(input);
+}
 
-                    const auto str = std::to_string(static_cast<int>(i)) 
-                                     + "." 
-                                     + (f? std::to_string(static_cast<int>(*f)) : "0");
+// Runs the memoized grammar, guaranteeing linear time.
 
-                    return std::stod(str); 
-                },
-                integer,
-                symbol('.'),
-                maybe(integer)
-            ),
-            sequence(
-                [](auto, const auto& x){ return std::stod("0." + std::to_string(x)); },
-                symbol('.'),
-                integer
-            )
-        )
-    )(input);
+auto packrat(std::string_view input, Memo_stats* stats) -> Parsed
+{
+    const Memo_scope scope;
+    auto parsed = Memoized::Expression(input);
+
+    if(stats != nullptr)
+    {
+        *stats = scope.Stats();
+    }
+
+    return parsed;
 }
@@ -1,11 +1,19 @@
 #pragma once
 
+#include <atomic>
+#include <bit>
+#include <charconv>
 #include <concepts>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 // Basic definitions
 
@@ -64,9 +72,9 @@ constexpr Parser auto operator&(P parser, F func)
 
     return [=](std::string_view input) -> Parser_result_t<Parser_t>
     {
-        if(auto const& result = std::invoke(parser, input)) 
+        if(auto result = std::invoke(parser, input)) 
         {
-            return std::invoke(std::invoke(func, result->first), result->second);
+            return std::invoke(std::invoke(func, std::move(result->first)), result->second);
         } 
 
         return {};
@@ -104,11 +112,11 @@ constexpr Parser auto operator^(P p, Q q)
 
     return [=](std::string_view input) -> Parsed_t<Result_t>
     {
-        if(auto const& pr = std::invoke(p, input))
+        if(auto pr = std::invoke(p, input))
         {
-            if(auto const& qr = std::invoke(q, pr->second))
+            if(auto qr = std::invoke(q, pr->second))
             {
-                return {{papply(pr->first, qr->first), qr->second}};
+                return {{papply(std::move(pr->first), std::move(qr->first)), qr->second}};
             }
             else
             {
@@ -127,6 +135,11 @@ constexpr Parser auto sequence(F func, Ps... parsers)
     return (unit(func) ^ ... ^ parsers);
 }
 
+// Folds every successive match of `parser` into `init` with `func`.
+// Iterative: the accumulator is moved through `func`, so n matches cost n
+// calls and constant stack, and the whole fold is O(n) as long as `func`
+// appends in amortized O(1). A match that consumes nothing ends the fold.
+
 template <typename T, Parser P, std::regular_invocable<T, Parser_value_t<P>> F>
 requires std::convertible_to<std::invoke_result_t<F, T, Parser_value_t<P>>, T>
 class reduce_many
@@ -142,42 +155,44 @@ public:
 
     constexpr auto operator()(std::string_view input) const -> Parsed_t<T>
     {
-        return either
-        (
-            chain
-            (
-                parser,
-                [this](auto const& thing)
-                {
-                    return reduce_many{std::invoke(func, init, thing), parser, func};
-                }
-            ),
-            unit(init)
-        )(input);
+        T acc = init;
+
+        while(auto result = std::invoke(parser, input))
+        {
+            if(result->second.size() == input.size())
+            {
+                break;
+            }
+
+            acc = std::invoke(func, std::move(acc), std::move(result->first));
+            input = result->second;
+        }
+
+        return {{std::move(acc), input}};
     }
 };
 
+inline constexpr auto appended_string = [](std::string st, char ch)
+{
+    st.push_back(ch);
+    return st;
+};
+
 template <Parser P>
 requires std::same_as<Parser_value_t<P>, char>
 constexpr Parser auto many(P parser)
 {
-    return reduce_many
-    (
-        std::string{},
-        parser,
-        [](std::string const& st, char ch){ return st + ch; }
-    );
+    return reduce_many(std::string{}, parser, appended_string);
 }
 
 template <Parser P>
 requires std::same_as<Parser_value_t<P>, char>
 constexpr Parser auto some(P parser)
 {
-    return sequence
+    return chain
     (
-        [](char ch, std::string const& st){ return std::string(1, ch) + st; },
         parser,
-        many(parser)
+        [parser](char ch){ return reduce_many(std::string(1, ch), parser, appended_string); }
     );
 }
 
@@ -195,7 +210,7 @@ constexpr Parser auto operator|(P p, Q q)
 {
     return [=](std::string_view input) -> Parser_result_t<Q>
     {
-        if(const auto& result = std::invoke(p, input)) 
+        if(auto result = std::invoke(p, input)) 
         {
             return result;
         }
@@ -263,16 +278,12 @@ constexpr Parser auto maybe(P parser)
 {
     return [parser](std::string_view input) -> Parsed_t<std::optional<Parser_value_t<P>>>
     {
-        return either
-        (
-            chain
-            (
-                parser, 
-                [](auto const& thing){ return unit(std::optional{thing}); }
-            ),
-            unit(std::optional<Parser_value_t<P>>{})
-        )
-        (input);
+        if(auto result = std::invoke(parser, input))
+        {
+            return {{std::optional{std::move(result->first)}, result->second}};
+        }
+
+        return {{std::nullopt, input}};
     };
 }
 
@@ -318,7 +329,7 @@ constexpr Parser auto token(Parser auto parser)
 {
     return sequence
     (
-        [](auto const& thing, auto){ return thing; },
+        [](auto thing, auto){ return thing; },
         skip(whitespace, parser),
         whitespace
     );
@@ -326,9 +337,9 @@ constexpr Parser auto token(Parser auto parser)
 
 
 template <typename T>
-auto appended_vector(std::vector<T> x, T const& y) -> std::vector<T>
+auto appended_vector(std::vector<T> x, T y) -> std::vector<T>
 {
-    x.push_back(y);
+    x.push_back(std::move(y));
     return x;
 }
 
@@ -341,18 +352,117 @@ Parser auto repeat(P parser)
     (
         Ts{},
         parser,
-        [](Ts const& ts, T const& t){ return appended_vector(ts, t); }
+        [](Ts ts, T t){ return appended_vector(std::move(ts), std::move(t)); }
     );
 }
 
-Parser auto natural = chain
-(
-    some(digit),
-    [](const std::string& digits) { return unit(std::stod(digits)); }
-);
+// Numbers
+
+// Length of the leading run of decimal digits.
+// Eight bytes are classified at once: after xor-ing with '0', digit bytes hold
+// 0..9, and adding 0x76 sets the high bit of every byte that holds more.
+
+inline auto digit_run(std::string_view input) -> std::size_t
+{
+    std::size_t n = 0;
+
+    if constexpr(std::endian::native == std::endian::little)
+    {
+        constexpr std::uint64_t zeros = 0x3030303030303030ULL;
+        constexpr std::uint64_t lows = 0x7F7F7F7F7F7F7F7FULL;
+        constexpr std::uint64_t bias = 0x7676767676767676ULL;
+        constexpr std::uint64_t highs = 0x8080808080808080ULL;
+
+        for(; n + sizeof(std::uint64_t) <= input.size(); n += sizeof(std::uint64_t))
+        {
+            std::uint64_t word{};
+            std::memcpy(&word, input.data() + n, sizeof(word));
+
+            const auto t = word ^ zeros;
+            const auto nonDigits = (((t & lows) + bias) | t) & highs;
+
+            if(nonDigits != 0)
+            {
+                return n + static_cast<std::size_t>(std::countr_zero(nonDigits)) / 8U;
+            }
+        }
+    }
+
+    while(n < input.size() && input[n] >= '0' && input[n] <= '9')
+    {
+        ++n;
+    }
+
+    return n;
+}
 
+// number         → digits [ "." [ digits ] ] [ exponent ] | "." digits [ exponent ] ;
+// exponent       → ( "e" | "E" ) [ "+" | "-" ] digits ;
+// Scanned in place and converted with std::from_chars: no allocation.
 
-Parser auto integer = either
+inline constexpr auto number = [](std::string_view input) -> Parsed_t<double>
+{
+    auto n = digit_run(input);
+    const auto integral = n;
+
+    if(n < input.size() && input[n] == '.')
+    {
+        const auto fraction = digit_run(input.substr(n + 1));
+
+        if(integral == 0 && fraction == 0)
+        {
+            return {};
+        }
+
+        n += 1 + fraction;
+    }
+    else if(integral == 0)
+    {
+        return {};
+    }
+
+    if(n < input.size() && (input[n] == 'e' || input[n] == 'E'))
+    {
+        auto m = n + 1;
+
+        if(m < input.size() && (input[m] == '+' || input[m] == '-'))
+        {
+            ++m;
+        }
+
+        if(const auto exponent = digit_run(input.substr(m)); exponent > 0)
+        {
+            n = m + exponent;
+        }
+    }
+
+    double value{};
+    const auto [ptr, ec] = std::from_chars(input.data(), input.data() + n, value);
+
+    if(ec != std::errc{})
+    {
+        return {};
+    }
+
+    return {{value, input.substr(n)}};
+};
+
+inline constexpr auto natural = [](std::string_view input) -> Parsed_t<double>
+{
+    const auto n = digit_run(input);
+
+    if(n == 0)
+    {
+        return {};
+    }
+
+    double value{};
+    std::from_chars(input.data(), input.data() + n, value);
+
+    return {{value, input.substr(n)}};
+};
+
+inline Parser auto integer = either
 (
     natural,
     chain
@@ -364,6 +474,177 @@ Parser auto integer = either
 );
 
 
+// Packrat memoization
+
+// memo(parser) caches its results while a Memo_scope is alive on the calling
+// thread, and parses straight through otherwise. Entries are keyed by rule
+// and input offset: all inputs seen inside one scope are suffixes of the same
+// text, so the remaining length stands for the offset. Scopes do not nest.
+// While no scope is alive on any thread, memo only reads a global counter.
+
+struct Memo_stats
+{
+    std::size_t hits{};
+    std::size_t misses{};
+};
+
+class Memo_scope
+{
+public:
+
+    struct State
+    {
+        std::size_t generation{};
+        bool active{};
+        Memo_stats stats;
+        std::vector<void (*)()> releases;     // one a memo table of this thread
+    };
+
+    Memo_scope()
+    {
+        auto& s = Current();
+        ++s.generation;
+        s.active = true;
+        s.stats = {};
+        live.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Releases the memoized results: they hold subtrees of the parse.
+    ~Memo_scope()
+    {
+        auto& s = Current();
+        ++s.generation;
+        s.active = false;
+        live.fetch_sub(1, std::memory_order_relaxed);
+
+        for(const auto release : s.releases)
+        {
+            release();
+        }
+    }
+
+    Memo_scope(const Memo_scope&) = delete;
+    auto operator=(const Memo_scope&) -> Memo_scope& = delete;
+
+    auto Stats() const -> Memo_stats
+    {
+        return Current().stats;
+    }
+
+    static auto Current() -> State&
+    {
+        thread_local State state;
+        return state;
+    }
+
+    // A thread always sees its own scopes counted.
+    static auto IsAnyActive() -> bool
+    {
+        return live.load(std::memory_order_relaxed) != 0;
+    }
+
+private:
+
+    inline static std::atomic<std::size_t> live{};
+};
+
+struct Memo_key
+{
+    std::size_t rule;
+    std::size_t offset;
+
+    auto operator==(const Memo_key&) const -> bool = default;
+};
+
+struct Memo_key_hash
+{
+    auto operator()(const Memo_key& k) const -> std::size_t
+    {
+        return std::hash<std::size_t>{}(k.rule * 0x9E3779B97F4A7C15ULL ^ k.offset);
+    }
+};
+
+template <typename T>
+struct Memo_table
+{
+    std::size_t generation{};
+    std::unordered_map<Memo_key, Parsed_t<T>, Memo_key_hash> entries;
+};
+
+template <typename T>
+auto memo_table() -> Memo_table<T>&
+{
+    thread_local Memo_table<T> table = []
+    {
+        Memo_scope::Current().releases.push_back([]
+        {
+            auto& entries = memo_table<T>().entries;
+            std::remove_reference_t<decltype(entries)>{}.swap(entries);
+        });
+
+        return Memo_table<T>{};
+    }();
+
+    return table;
+}
+
+inline auto next_memo_rule() -> std::size_t
+{
+    static std::atomic<std::size_t> rules{};
+    return rules++;
+}
+
+template <Parser P>
+class memo
+{
+    P parser;
+    std::size_t rule{next_memo_rule()};
+
+public:
+
+    memo(P const& p) : parser{p}
+    {
+    }
+
+    auto operator()(std::string_view input) const -> Parser_result_t<P>
+    {
+        if(!Memo_scope::IsAnyActive())
+        {
+            return std::invoke(parser, input);
+        }
+
+        auto& scope = Memo_scope::Current();
+
+        if(!scope.active)
+        {
+            return std::invoke(parser, input);
+        }
+
+        auto& table = memo_table<Parser_value_t<P>>();
+
+        if(table.generation != scope.generation)
+        {
+            table.entries.clear();
+            table.generation = scope.generation;
+        }
+
+        const Memo_key key{rule, input.size()};
+
+        if(const auto it = table.entries.find(key); it != table.entries.end())
+        {
+            ++scope.stats.hits;
+            return it->second;
+        }
+
+        ++scope.stats.misses;
+
+        auto result = std::invoke(parser, input);
+        table.entries.insert_or_assign(key, result);
+
+        return result;
+    }
+};
+
 struct Expr;
 
 using Value_t = Expr;
@@ -374,4 +655,8 @@ auto term(std::string_view) -> Parsed;
 auto factor(std::string_view) -> Parsed;
 auto unary(std::string_view) -> Parsed;
 auto primary(std::string_view) -> Parsed;
-auto real(std::string_view) -> Parsed;
\ No newline at end of file
+auto real(std::string_view) -> Parsed;
+
+auto packrat(std::string_view, Memo_stats* = nullptr) -> Parsed;
+
+auto pratt(std::string_view) -> Parsed;
\ No newline at end of file
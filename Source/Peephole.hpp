@@ -0,0 +1,250 @@
+#pragma once
+
+#include "Compiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Peephole optimizer over compiled chunks. Instructions are decoded and
+// appended one by one to an output window, and each rewrite looks at the
+// tail of that window, so rewrites cascade: `2 3 * -` folds to one push.
+//
+// Local and Fold rewrites give bit-identical results, Contract does not:
+// a fused multiply-add rounds once where Mul then Add round twice.
+
+struct Peephole
+{
+    static constexpr unsigned Local = 1U;       // Neg Neg, x / 2^k → x * 2^-k, Push c; Add → AddImm c
+    static constexpr unsigned Fold = 2U;        // constant operations, constant slots
+    static constexpr unsigned Contract = 4U;    // a * b + c → Fma
+};
+
+// Passes of each -O level.
+inline constexpr std::array<unsigned, 4> optimizationLevels
+{
+    0U,
+    Peephole::Local,
+    Peephole::Local | Peephole::Fold,
+    Peephole::Local | Peephole::Fold | Peephole::Contract,
+};
+
+struct Peephole_stats
+{
+    std::size_t before{}, after{};      // instructions
+    std::size_t folded{}, negations{}, reciprocals{}, immediates{}, fused{};
+};
+
+namespace detail
+{
+    // Start of the shortest tail of `code` that computes exactly one value,
+    // looking back at most `window` instructions.
+    inline auto operand_start(const std::vector<Instruction>& code, std::size_t window) -> std::optional<std::size_t>
+    {
+        int height{};
+
+        for(auto k = code.size(); k > 0 && code.size() - k < window; --k)
+        {
+            height += stack_effect(code[k - 1].code);
+
+            if(height == 1)
+            {
+                return k - 1;
+            }
+        }
+
+        return {};
+    }
+
+    // 1/c when it is exact, i.e. c is a power of two: then x / c == x * (1/c).
+    inline auto exact_reciprocal(Data_t c) -> std::optional<Data_t>
+    {
+        const auto r = 1.0 / c;
+
+        if(std::isfinite(r) && r != 0.0 && std::fma(r, c, -1.0) == 0.0)
+        {
+            return r;
+        }
+
+        return {};
+    }
+
+    constexpr auto apply(std::byte code, Data_t lhs, Data_t rhs) -> Data_t
+    {
+        return code == OpCode::Add ? lhs + rhs
+             : code == OpCode::Sub ? lhs - rhs
+             : code == OpCode::Mul ? lhs * rhs
+             : lhs / rhs;
+    }
+}
+
+inline auto optimize(Chunk_view chunk, unsigned passes, Peephole_stats* stats = nullptr) -> Chunk_t
+{
+    using namespace detail;
+
+    constexpr std::size_t window = 64;
+
+    Peephole_stats ownStats;
+    auto& st = stats != nullptr ? *stats : ownStats;
+    st = {};
+    st.before = count_instructions(chunk.code);
+
+    if(passes == 0)
+    {
+        st.after = st.before;
+        return {{chunk.constants.begin(), chunk.constants.end()}, std::string{chunk.code}, chunk.depth};
+    }
+
+    const auto local = (passes & Peephole::Local) != 0;
+    const auto fold = (passes & Peephole::Fold) != 0;
+    const auto contract = (passes & Peephole::Contract) != 0;
+
+    std::vector<Instruction> out;
+    out.reserve(st.before);
+
+    std::vector<std::optional<Data_t>> slots;   // constant values of stored slots
+
+    const auto isConst = [&](std::size_t fromEnd)
+    {
+        return out.size() > fromEnd && is_push(out[out.size() - 1 - fromEnd].code);
+    };
+
+    // [a b Mul] [c] Add → a b c Fma, and [x] [a b Mul] Add → a b x Fma when
+    // x is a single push.
+    const auto fuse = [&]
+    {
+        const auto start = operand_start(out, window);
+
+        if(!start)
+        {
+            return false;
+        }
+
+        if(*start > 0 && out[*start - 1].code == OpCode::Mul)
+        {
+            out.erase(out.begin() + static_cast<std::ptrdiff_t>(*start - 1));
+            out.push_back({OpCode::Fma, {}, {}, 1});
+            return true;
+        }
+
+        if(out.back().code == OpCode::Mul && *start > 0 && is_push(out[*start - 1].code))
+        {
+            const auto addend = out[*start - 1];
+            out.erase(out.begin() + static_cast<std::ptrdiff_t>(*start - 1));
+            out.back() = addend;
+            out.push_back({OpCode::Fma, {}, {}, 1});
+            return true;
+        }
+
+        return false;
+    };
+
+    for(std::size_t pos = 0; pos < chunk.code.size();)
+    {
+        auto op = decode(chunk, pos);
+        pos += op.size;
+
+        if(op.code == OpCode::Neg)
+        {
+            if(fold && isConst(0))
+            {
+                out.back().value = -out.back().value;
+                ++st.folded;
+                continue;
+            }
+
+            if(local && !out.empty() && out.back().code == OpCode::Neg)
+            {
+                out.pop_back();
+                ++st.negations;
+                continue;
+            }
+        }
+        else if(op.code == OpCode::Add || op.code == OpCode::Sub || op.code == OpCode::Mul || op.code == OpCode::Div)
+        {
+            if(fold && isConst(0) && isConst(1))
+            {
+                const auto rhs = out.back().value;
+                out.pop_back();
+                out.back().value = apply(op.code, out.back().value, rhs);
+                ++st.folded;
+                continue;
+            }
+
+            if(local && op.code == OpCode::Div && isConst(0))
+            {
+                if(const auto r = exact_reciprocal(out.back().value))
+                {
+                    out.back().value = *r;
+                    op.code = OpCode::Mul;
+                    ++st.reciprocals;
+                }
+            }
+
+            if(contract && op.code == OpCode::Add && fuse())
+            {
+                ++st.fused;
+                continue;
+            }
+
+            // x - c == x + (-c) exactly.
+            if(local && (op.code == OpCode::Add || op.code == OpCode::Sub) && isConst(0))
+            {
+                const auto c = out.back().value;
+                out.back() = {OpCode::AddImm, op.code == OpCode::Sub ? -c : c, {}, 3};
+                ++st.immediates;
+                continue;
+            }
+        }
+        else if(op.code == OpCode::Store && fold && isConst(0))
+        {
+            // Store keeps the value on the stack: a constant needs no slot,
+            // its Loads become pushes.
+            slots.resize(std::max<std::size_t>(slots.size(), op.slot + 1));
+            slots[op.slot] = out.back().value;
+            ++st.folded;
+            continue;
+        }
+        else if(op.code == OpCode::Store && op.slot < slots.size())
+        {
+            // A value that is not constant replaces the slot's constant.
+            slots[op.slot].reset();
+        }
+        else if(op.code == OpCode::Load && op.slot < slots.size() && slots[op.slot])
+        {
+            op = {OpCode::PushConst32, *slots[op.slot], {}, 5};
+        }
+
+        out.push_back(op);
+    }
+
+    Chunk_builder builder{out.size() * 2};
+
+    for(const auto& op : out)
+    {
+        if(is_push(op.code))
+        {
+            builder.Push(op.value);
+        }
+        else if(op.code == OpCode::AddImm)
+        {
+            builder.AddImm(op.value);
+        }
+        else if(op.code == OpCode::Store || op.code == OpCode::Load)
+        {
+            builder.Emit(op.code, op.slot);
+        }
+        else
+        {
+            builder.Emit(op.code);
+        }
+    }
+
+    auto optimized = builder.Take();
+    st.after = count_instructions(optimized.code);
+    return optimized;
+}
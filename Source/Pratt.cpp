@@ -0,0 +1,268 @@
+#include "Parser.hpp"
+#include "Ast.hpp"
+#include "FlatAst.hpp"
+#include "Lexer.hpp"
+
+#include <array>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+
+// Precedence climbing front end.
+// Same grammar as expression(), but driven by a static operator table over
+// the token array from lex(): each token is looked at once and no combinator
+// object is built per call. Nodes are made by a builder, either shared_ptr
+// trees (Expr) or an arena (Flat_ast).
+
+namespace
+{
+    struct Operator
+    {
+        Token_kind kind;
+        int precedence;
+        Node_op op;
+    };
+
+    constexpr std::array operators
+    {
+        Operator{Token_kind::Plus,  1, Node_op::Add},
+        Operator{Token_kind::Minus, 1, Node_op::Sub},
+        Operator{Token_kind::Star,  2, Node_op::Mul},
+        Operator{Token_kind::Slash, 2, Node_op::Div},
+    };
+
+    constexpr auto findOperator(Token_kind kind) -> const Operator*
+    {
+        for(const auto& op : operators)
+        {
+            if(op.kind == kind)
+            {
+                return &op;
+            }
+        }
+
+        return nullptr;
+    }
+
+    struct Tree_builder
+    {
+        using Value_t = Expr;
+
+        auto Constant(Data_t value) -> Expr
+        {
+            return Expr{value};
+        }
+
+        auto Negate(Expr e) -> Expr
+        {
+            return MakeExpr<Neg>(std::move(e));
+        }
+
+        auto Binary(Node_op op, Expr lhs, Expr rhs) -> Expr
+        {
+            switch(op)
+            {
+                case Node_op::Add: return MakeExpr<Add>(std::move(lhs), std::move(rhs));
+                case Node_op::Sub: return MakeExpr<Sub>(std::move(lhs), std::move(rhs));
+                case Node_op::Mul: return MakeExpr<Mul>(std::move(lhs), std::move(rhs));
+                default: return MakeExpr<Div>(std::move(lhs), std::move(rhs));
+            }
+        }
+
+        auto Mark() const -> Node_t
+        {
+            return 0;
+        }
+
+        void Rollback(Node_t)
+        {
+        }
+    };
+
+    template <typename Arena>
+    struct Arena_builder
+    {
+        using Value_t = Node_t;
+
+        Arena& ast;
+
+        auto Constant(Data_t value) -> Node_t
+        {
+            return ast.Constant(value);
+        }
+
+        auto Negate(Node_t n) -> Node_t
+        {
+            return ast.Negate(n);
+        }
+
+        auto Binary(Node_op op, Node_t lhs, Node_t rhs) -> Node_t
+        {
+            return ast.Binary(op, lhs, rhs);
+        }
+
+        auto Mark() const -> Node_t
+        {
+            return ast.Size();
+        }
+
+        void Rollback(Node_t mark)
+        {
+            ast.Rollback(mark);
+        }
+    };
+
+    template <typename Builder>
+    class Pratt
+    {
+    public:
+
+        using Value_t = typename Builder::Value_t;
+
+        Pratt(std::string_view in, std::span<const Token> t, Builder b) : input{in}, tokens{t}, build{b} {}
+
+        auto Parse() -> Parsed_t<Value_t>
+        {
+            auto e = Binary(1);
+
+            if(!e)
+            {
+                return {};
+            }
+
+            return {{std::move(*e), input.substr(tokens[pos].offset)}};
+        }
+
+    private:
+
+        auto Peek() const -> Token_kind
+        {
+            return tokens[pos].kind;
+        }
+
+        // binary         → unary { op binary(op.precedence + 1) } ;
+
+        auto Binary(int minPrecedence) -> std::optional<Value_t>
+        {
+            auto lhs = Unary();
+
+            if(!lhs)
+            {
+                return {};
+            }
+
+            for(;;)
+            {
+                const auto op = findOperator(Peek());
+
+                if(op == nullptr || op->precedence < minPrecedence)
+                {
+                    break;
+                }
+
+                const auto start = pos++;
+                const auto mark = build.Mark();
+                auto rhs = Binary(op->precedence + 1);
+
+                if(!rhs)
+                {
+                    pos = start;
+                    build.Rollback(mark);
+                    break;
+                }
+
+                lhs = build.Binary(op->op, std::move(*lhs), std::move(*rhs));
+            }
+
+            return lhs;
+        }
+
+        // unary          → "-" unary | primary ;
+
+        auto Unary() -> std::optional<Value_t>
+        {
+            const auto start = pos;
+
+            while(Peek() == Token_kind::Minus)
+            {
+                ++pos;
+            }
+
+            const auto negations = pos - start;
+            auto u = Primary();
+
+            if(!u)
+            {
+                pos = start;
+                return {};
+            }
+
+            for(std::size_t i = 0; i < negations; ++i)
+            {
+                u = build.Negate(std::move(*u));
+            }
+
+            return u;
+        }
+
+        // primary        → number | "(" binary ")" ;
+
+        auto Primary() -> std::optional<Value_t>
+        {
+            if(Peek() == Token_kind::Number)
+            {
+                return build.Constant(tokens[pos++].value);
+            }
+
+            if(Peek() == Token_kind::LeftParen)
+            {
+                const Nesting_guard guard;
+                const auto start = pos++;
+                const auto mark = build.Mark();
+                auto e = Binary(1);
+
+                if(!e || Peek() != Token_kind::RightParen)
+                {
+                    pos = start;
+                    build.Rollback(mark);
+                    return {};
+                }
+
+                ++pos;
+                return e;
+            }
+
+            return {};
+        }
+
+        std::string_view input;
+        std::span<const Token> tokens;
+        Builder build;
+        std::size_t pos{};
+    };
+
+    auto tokenize(std::string_view input) -> const Tokens_t&
+    {
+        thread_local Tokens_t tokens;
+        lex(input, tokens);
+        return tokens;
+    }
+}
+
+auto pratt(std::string_view input) -> Parsed
+{
+    return Pratt{input, tokenize(input), Tree_builder{}}.Parse();
+}
+
+auto pratt(std::string_view input, Flat_ast& ast) -> Parsed_t<Node_t>
+{
+    ast.Clear();
+    return Pratt{input, tokenize(input), Arena_builder<Flat_ast>{ast}}.Parse();
+}
+
+auto pratt(std::string_view input, Hash_consing& ast) -> Parsed_t<Node_t>
+{
+    ast.Clear();
+    return Pratt{input, tokenize(input), Arena_builder<Hash_consing>{ast}}.Parse();
+}
@@ -0,0 +1,325 @@
+#pragma once
+
+#include "Compiler.hpp"
+
+// Opcode profiler for exec and Vm, compiled in with INTERPRETER_PROFILE=1
+// (the CMake option of the same name) and out otherwise: the executors are
+// then exactly what they were. Each thread counts opcodes, opcode pairs and
+// the deepest stack it saw, and times one dispatch in `samplePeriod` with
+// the time stamp counter, from its start to the start of the next one.
+// Threads add their counts to the totals when they end, and the totals are
+// reported when the program exits: as text on stderr, and as JSON to the
+// file INTERPRETER_PROFILE_JSON names, when set.
+//
+// Frequent pairs are the candidates for a superinstruction or a peephole
+// rule; their count is what the dispatch of the second opcode costs.
+
+#ifndef INTERPRETER_PROFILE
+#define INTERPRETER_PROFILE 0
+#endif
+
+#if INTERPRETER_PROFILE
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+inline constexpr std::size_t nbOpcodes = static_cast<std::size_t>(OpCode::Fma) + 1;
+
+inline constexpr std::array<std::string_view, nbOpcodes> opcodeNames
+{
+    "NoOp", "PushConst8", "Return", "Neg", "Add", "Sub", "Mul", "Div", "Store", "Load",
+    "PushConst16", "PushConst32", "PushInt8", "PushZero", "PushOne", "PushMinusOne", "PushInt16", "AddImm", "Fma",
+};
+
+// Cycles with rdtsc, nanoseconds where there is none.
+inline auto timestamp() -> std::uint64_t
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+struct Opcode_counts
+{
+    std::array<std::uint64_t, nbOpcodes> counts{}, cycles{}, samples{};
+    std::array<std::array<std::uint64_t, nbOpcodes>, nbOpcodes> pairs{};
+    std::size_t maxDepth{};
+
+    void Merge(const Opcode_counts& other)
+    {
+        for(std::size_t i = 0; i < nbOpcodes; ++i)
+        {
+            counts[i] += other.counts[i];
+            cycles[i] += other.cycles[i];
+            samples[i] += other.samples[i];
+
+            for(std::size_t j = 0; j < nbOpcodes; ++j)
+            {
+                pairs[i][j] += other.pairs[i][j];
+            }
+        }
+
+        maxDepth = std::max(maxDepth, other.maxDepth);
+    }
+};
+
+// Totals of every thread, reported when destroyed, at exit.
+
+class Profile_report
+{
+public:
+
+    Profile_report() = default;
+    Profile_report(const Profile_report&) = delete;
+    auto operator=(const Profile_report&) -> Profile_report& = delete;
+
+    ~Profile_report()
+    {
+        Text(std::cerr);
+
+        if(const auto* path = std::getenv("INTERPRETER_PROFILE_JSON"))
+        {
+            std::ofstream out{path};
+            Json(out);
+        }
+    }
+
+    void Add(const Opcode_counts& counts)
+    {
+        std::scoped_lock lock{mutex};
+        totals.Merge(counts);
+    }
+
+private:
+
+    auto Average(std::size_t op) const -> double
+    {
+        return totals.samples[op] == 0 ? 0.0 : static_cast<double>(totals.cycles[op]) / static_cast<double>(totals.samples[op]);
+    }
+
+    void Text(std::ostream& out) const
+    {
+        std::uint64_t dispatches{};
+        double cycles{};
+
+        for(std::size_t op = 0; op < nbOpcodes; ++op)
+        {
+            dispatches += totals.counts[op];
+            cycles += Average(op) * static_cast<double>(totals.counts[op]);
+        }
+
+        if(dispatches == 0)
+        {
+            return;
+        }
+
+        const auto share = [](double part, double whole) { return whole == 0 ? 0.0 : part / whole * 100.0; };
+
+        std::vector<std::size_t> ops;
+
+        for(std::size_t op = 0; op < nbOpcodes; ++op)
+        {
+            if(totals.counts[op] != 0)
+            {
+                ops.push_back(op);
+            }
+        }
+
+        std::ranges::sort(ops, std::greater{}, [&](std::size_t op) { return totals.counts[op]; });
+
+        out << "🔬 " << dispatches << " dispatches, max stack depth " << totals.maxDepth << std::endl;
+        out << std::left << std::setw(16) << "opcode" << std::right << std::setw(14) << "count" << std::setw(10) << "%"
+            << std::setw(12) << "cycles/op" << std::setw(10) << "% cycles" << std::endl;
+
+        for(const auto op : ops)
+        {
+            const auto count = static_cast<double>(totals.counts[op]);
+
+            out << std::left << std::setw(16) << opcodeNames[op] << std::right << std::setw(14) << totals.counts[op]
+                << std::fixed << std::setprecision(2)
+                << std::setw(10) << share(count, static_cast<double>(dispatches))
+                << std::setw(12) << Average(op)
+                << std::setw(10) << share(Average(op) * count, cycles) << std::endl;
+        }
+
+        std::vector<std::pair<std::size_t, std::size_t>> pairs;
+
+        for(std::size_t i = 0; i < nbOpcodes; ++i)
+        {
+            for(std::size_t j = 0; j < nbOpcodes; ++j)
+            {
+                if(totals.pairs[i][j] != 0)
+                {
+                    pairs.emplace_back(i, j);
+                }
+            }
+        }
+
+        std::ranges::sort(pairs, std::greater{}, [&](const auto& p) { return totals.pairs[p.first][p.second]; });
+        pairs.resize(std::min<std::size_t>(pairs.size(), 12));
+
+        out << "🔬 most frequent pairs" << std::endl;
+
+        for(const auto& [first, second] : pairs)
+        {
+            const auto count = totals.pairs[first][second];
+            const auto name = std::string{opcodeNames[first]} + " → " + std::string{opcodeNames[second]};
+
+            out << "    " << std::left << std::setw(30) << name << std::right << std::setw(14) << count
+                << std::setw(10) << std::fixed << std::setprecision(2) << share(static_cast<double>(count), static_cast<double>(dispatches))
+                << " % of dispatches" << std::endl;
+        }
+    }
+
+    void Json(std::ostream& out) const
+    {
+        out << "{\"maxDepth\": " << totals.maxDepth << ", \"opcodes\": [";
+
+        for(std::size_t op = 0; op < nbOpcodes; ++op)
+        {
+            out << (op == 0 ? "" : ", ") << "{\"name\": \"" << opcodeNames[op] << "\", \"count\": " << totals.counts[op]
+                << ", \"cycles\": " << Average(op) << ", \"samples\": " << totals.samples[op] << "}";
+        }
+
+        out << "], \"pairs\": [";
+        auto comma = "";
+
+        for(std::size_t i = 0; i < nbOpcodes; ++i)
+        {
+            for(std::size_t j = 0; j < nbOpcodes; ++j)
+            {
+                if(totals.pairs[i][j] != 0)
+                {
+                    out << comma << "{\"first\": \"" << opcodeNames[i] << "\", \"second\": \"" << opcodeNames[j]
+                        << "\", \"count\": " << totals.pairs[i][j] << "}";
+                    comma = ", ";
+                }
+            }
+        }
+
+        out << "]}" << std::endl;
+    }
+
+    std::mutex mutex;
+    Opcode_counts totals;
+};
+
+inline auto profile_report() -> Profile_report&
+{
+    static Profile_report report;
+    return report;
+}
+
+// One a thread. Enter is called before every dispatch with the stack height
+// at that point, Exit when the executor returns.
+
+class Opcode_profiler
+{
+public:
+
+    static constexpr std::uint64_t samplePeriod = 64;
+    static constexpr std::uint64_t maxSample = 10'000;
+
+    Opcode_profiler() : report{profile_report()}
+    {
+        // What reading the counter twice costs, taken off every sample.
+        overhead = ~std::uint64_t{};
+
+        for(int i = 0; i < 16; ++i)
+        {
+            const auto before = timestamp();
+            overhead = std::min(overhead, timestamp() - before);
+        }
+    }
+
+    Opcode_profiler(const Opcode_profiler&) = delete;
+    auto operator=(const Opcode_profiler&) -> Opcode_profiler& = delete;
+
+    ~Opcode_profiler()
+    {
+        Leave();
+        report.Add(counts);
+    }
+
+    void Enter(std::byte code, std::size_t depth)
+    {
+        const auto op = std::min(static_cast<std::size_t>(code), nbOpcodes - 1);
+
+        Leave();
+        ++counts.counts[op];
+        counts.maxDepth = std::max(counts.maxDepth, depth);
+
+        if(hasPrevious)
+        {
+            ++counts.pairs[previous][op];
+        }
+
+        previous = op;
+        hasPrevious = true;
+
+        if(++dispatches % samplePeriod == 0)
+        {
+            sampled = op;
+            isSampling = true;
+            start = timestamp();
+        }
+    }
+
+    // Ends the sample in progress.
+    void Leave()
+    {
+        if(isSampling)
+        {
+            const auto elapsed = timestamp() - start;
+
+            // Longer than any dispatch: the thread was interrupted.
+            if(elapsed < maxSample)
+            {
+                counts.cycles[sampled] += elapsed - std::min(elapsed, overhead);
+                ++counts.samples[sampled];
+            }
+
+            isSampling = false;
+        }
+    }
+
+    // No pair across runs.
+    void Exit()
+    {
+        Leave();
+        hasPrevious = false;
+    }
+
+private:
+
+    Profile_report& report;
+    Opcode_counts counts;
+    std::uint64_t dispatches{}, start{}, overhead{};
+    std::size_t previous{}, sampled{};
+    bool hasPrevious{}, isSampling{};
+};
+
+inline auto profiler() -> Opcode_profiler&
+{
+    thread_local Opcode_profiler p;
+    return p;
+}
+
+#endif
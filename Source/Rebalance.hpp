@@ -0,0 +1,192 @@
+#pragma once
+
+#include "Ast.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Tree-height reduction: the parsers fold `a + b + c + d` into left-deep
+// trees, a serial chain of dependent operations. rebalance() gathers maximal
+// chains of + and - (and of *) into flat operand lists and rebuilds them as
+// balanced trees, so independent operations can overlap.
+//
+// Reassociation changes rounding, so this is only valid under relaxed
+// floating-point semantics and must be opted into. Turning `a - b` into
+// `a + (-b)` is exact: subtractions are gathered as negated terms and every
+// chain is rebuilt as (sum of positive terms) - (sum of negated terms).
+// Division is not reassociated and bounds the chains around it.
+
+namespace detail
+{
+    enum class Chain_kind { Additive, Multiplicative };
+
+    struct Term
+    {
+        Expr expr;
+        bool negated;
+    };
+
+    // A chain still open to its parent. `negated` flips every term, so that
+    // negating a whole chain is O(1).
+    struct Chain
+    {
+        Chain_kind kind;
+        bool negated;
+        std::deque<Term> terms;
+    };
+
+    using Operand = std::variant<Expr, Chain>;
+
+    template <typename E>
+    auto balanced(std::vector<Expr> level) -> Expr
+    {
+        while(level.size() > 1)
+        {
+            std::vector<Expr> next;
+            next.reserve(level.size() / 2 + 1);
+
+            for(std::size_t i = 0; i + 1 < level.size(); i += 2)
+            {
+                next.push_back(MakeExpr<E>(std::move(level[i]), std::move(level[i + 1])));
+            }
+
+            if(level.size() % 2 != 0)
+            {
+                next.push_back(std::move(level.back()));
+            }
+
+            level = std::move(next);
+        }
+
+        return std::move(level.front());
+    }
+
+    inline auto close(Operand&& operand) -> Expr
+    {
+        if(auto* expr = std::get_if<Expr>(&operand))
+        {
+            return std::move(*expr);
+        }
+
+        auto& chain = std::get<Chain>(operand);
+
+        if(chain.kind == Chain_kind::Multiplicative)
+        {
+            std::vector<Expr> factors;
+            factors.reserve(chain.terms.size());
+
+            for(auto& term : chain.terms)
+            {
+                factors.push_back(std::move(term.expr));
+            }
+
+            return balanced<Mul>(std::move(factors));
+        }
+
+        std::vector<Expr> positive, negative;
+
+        for(auto& term : chain.terms)
+        {
+            (term.negated != chain.negated ? negative : positive).push_back(std::move(term.expr));
+        }
+
+        if(negative.empty())
+        {
+            return balanced<Add>(std::move(positive));
+        }
+
+        if(positive.empty())
+        {
+            return MakeExpr<Neg>(balanced<Add>(std::move(negative)));
+        }
+
+        return MakeExpr<Sub>(balanced<Add>(std::move(positive)), balanced<Add>(std::move(negative)));
+    }
+
+    inline auto open(Chain_kind kind, Operand&& operand) -> Chain
+    {
+        if(auto* chain = std::get_if<Chain>(&operand); chain && chain->kind == kind)
+        {
+            return std::move(*chain);
+        }
+
+        Chain chain{kind, false, {}};
+        chain.terms.push_back({close(std::move(operand)), false});
+        return chain;
+    }
+
+    // Joins `rhs` after `lhs`, negating its terms for a subtraction. The
+    // shorter list is moved into the longer one, so building a chain costs
+    // O(n log n) whichever way the tree leans.
+    inline auto join(Chain lhs, Chain rhs, bool subtract) -> Chain
+    {
+        if(lhs.terms.size() >= rhs.terms.size())
+        {
+            const auto flip = rhs.negated != subtract;
+
+            for(auto& term : rhs.terms)
+            {
+                lhs.terms.push_back({std::move(term.expr), (term.negated != flip) != lhs.negated});
+            }
+
+            return lhs;
+        }
+
+        rhs.negated = rhs.negated != subtract;
+
+        for(auto it = lhs.terms.rbegin(); it != lhs.terms.rend(); ++it)
+        {
+            rhs.terms.push_front({std::move(it->expr), (it->negated != lhs.negated) != rhs.negated});
+        }
+
+        return rhs;
+    }
+}
+
+inline auto rebalance(const Expr& ast, std::size_t maxDepth = defaultMaxDepth) -> Expr
+{
+    using namespace detail;
+
+    std::vector<Operand> operands;
+
+    const auto pop = [&]
+    {
+        auto operand = std::move(operands.back());
+        operands.pop_back();
+        return operand;
+    };
+
+    post_order(ast, [&](const Expr& node, std::size_t)
+    {
+        std::visit(overloaded
+        {
+            [&](Data_t value) { operands.emplace_back(Expr{value}); },
+            [&](const Neg&)
+            {
+                auto chain = open(Chain_kind::Additive, pop());
+                chain.negated = !chain.negated;
+                operands.emplace_back(std::move(chain));
+            },
+            [&](const Div&)
+            {
+                auto rhs = close(pop());
+                auto lhs = close(pop());
+                operands.emplace_back(MakeExpr<Div>(std::move(lhs), std::move(rhs)));
+            },
+            [&]<typename B>(const B&)
+            {
+                constexpr auto kind = std::is_same_v<B, Mul> ? Chain_kind::Multiplicative : Chain_kind::Additive;
+
+                auto rhs = open(kind, pop());
+                auto lhs = open(kind, pop());
+                operands.emplace_back(join(std::move(lhs), std::move(rhs), std::is_same_v<B, Sub>));
+            },
+        }, static_cast<const Variant_t&>(node));
+    }, maxDepth);
+
+    return close(pop());
+}
@@ -0,0 +1,328 @@
+#pragma once
+
+#include "Benchmark.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Correctness checks, without the timing of the benchmarks: run with
+// `interpreter -s` and by ctest. Failures are counted with expect.
+
+inline void testRepetition()
+{
+    constexpr std::size_t items = 1'000'000;
+
+    const auto chars = std::string(items, 'a');
+    const auto digits = std::string(items, '7');
+
+    const auto m = many(symbol('a'))(chars);
+    expect(m && m->first.size() == items, "many");
+
+    const auto r = repeat(digit)(digits);
+    expect(r && r->first.size() == items, "repeat");
+
+    const auto s = some(digit)(digits);
+    expect(s && s->second.empty(), "some");
+
+    expect(!some(digit)("a"), "some on no match");
+
+    auto sum = std::string{"1"};
+
+    for(std::size_t i = 1; i < 10'000; ++i)
+    {
+        sum += "+1";
+    }
+
+    const auto e = expression(sum);
+    expect(e && e->second.empty() && eval(e->first) == 10'000, "10k-term sum");
+
+    Memo_stats stats;
+    const auto p = packrat("((1 + 2) * (3 - 4))", &stats);
+    expect(p && eval(p->first) == -3 && stats.misses > 0 && !Memo_scope::IsAnyActive(), "packrat memoizes inside its scope only");
+    expect(memo_table<Expr>().entries.empty(), "packrat releases its results with its scope");
+}
+
+// Native code must match eval bit for bit on unoptimized chunks, and exec
+// on contracted ones.
+
+inline void testJit()
+{
+    Formula_generator gen{19};
+
+    const auto same = [](Data_t a, Data_t b) { return a == b || (std::isnan(a) && std::isnan(b)); };
+
+    for(std::size_t i = 0; i < 300; ++i)
+    {
+        const auto tree = pratt(gen.Formula(8 + i % 24, 1 + i % 4))->first;
+        const auto chunk = compile(tree);
+
+        expect(same(Jit{verify(chunk)}.Run(), eval(tree)), "jit differs from eval: formula " + std::to_string(i));
+
+        const auto contracted = optimize(chunk, optimizationLevels[1] | Peephole::Contract);
+        expect(same(Jit{verify(contracted)}.Run(), exec(contracted)), "contracted jit differs from exec: formula " + std::to_string(i));
+    }
+}
+
+// Nesting limits below the work stack's initial 64 entries, and past the
+// native recursion of eval.
+
+inline void testDepth()
+{
+    const auto throws = [](auto f)
+    {
+        try
+        {
+            f();
+            return false;
+        }
+        catch(const Depth_error&)
+        {
+            return true;
+        }
+    };
+
+    const auto negations = [](std::size_t n) { return pratt(std::string(n, '-') + "1")->first; };
+
+    for(const std::size_t limit : {std::size_t{1}, std::size_t{10}, std::size_t{63}, std::size_t{64}, std::size_t{200}})
+    {
+        const auto within = negations(limit), beyond = negations(limit + 1);
+        const auto name = std::to_string(limit);
+
+        expect(!throws([&]{ eval(within, limit); }), "eval within " + name + " levels");
+        expect(throws([&]{ eval(beyond, limit); }), "eval past " + name + " levels");
+        expect(!throws([&]{ evalStack(within, limit); }), "evalStack within " + name + " levels");
+        expect(throws([&]{ evalStack(beyond, limit); }), "evalStack past " + name + " levels");
+    }
+
+    expect(throws([&]{ eval(negations(50), 10); }), "eval of 50 negations limited to 10");
+}
+
+// compile_expr parses literals as the runtime front ends do.
+
+template <Fixed_string Literal>
+void expectParsed()
+{
+    const auto parsed = number(Literal.View());
+    expect(parsed && compile_expr<Literal>().value == parsed->first, "compile-time parse of " + std::string{Literal.View()});
+}
+
+inline void testStatic()
+{
+    expectParsed<"9007199254740992">();
+    expectParsed<"9007199254740991e22">();
+    expectParsed<"9007199254740991e-22">();
+    expectParsed<"900719925474099.1">();
+    expectParsed<"1e-22">();
+    expectParsed<"1e23">();
+    expectParsed<"0.1">();
+    expectParsed<"2.225073858507201e-7">();
+
+    const auto unfolded = compile_expr<"1 / 0", Fold::None>();
+    expect(exec(unfolded.View()) == std::numeric_limits<Data_t>::infinity(), "unfolded 1 / 0");
+}
+
+inline void testFlat()
+{
+    Flat_ast flat;
+
+    try
+    {
+        eval(flat);
+        expect(false, "eval of an empty flat AST");
+    }
+    catch(const std::out_of_range&)
+    {
+    }
+
+    flatten(pratt("2 * (3 + 4)")->first, flat);
+    expect(eval(flat) == 14, "eval of a flat AST");
+
+    Flat_ast dag;
+    Hash_consing consing{dag};
+    const auto one = consing.Constant(1), two = consing.Constant(2);
+    const auto mark = consing.Size();
+
+    consing.Binary(Node_op::Add, one, consing.Constant(3));
+    consing.Rollback(mark);
+
+    const auto sum = consing.Binary(Node_op::Add, one, two);
+    expect(sum == mark && consing.Constant(3) == mark + 1 && consing.Constant(1) == one, "hash-consing rollback");
+}
+
+// A slot stored a constant, then a computed value, is loaded as the latter.
+
+inline void testPeephole()
+{
+    Chunk_builder builder{16};
+    builder.Push(2.0);
+    builder.Emit(OpCode::Store, Slot_t{0});
+    builder.Emit(OpCode::Load, Slot_t{1});
+    builder.Emit(OpCode::Store, Slot_t{0});
+    builder.Emit(OpCode::Load, Slot_t{0});
+    builder.Emit(OpCode::Return);
+
+    const auto chunk = optimize(builder.Finish(), optimizationLevels[3]);
+    std::size_t loads{};
+
+    for(std::size_t pos = 0; pos < chunk.code.size();)
+    {
+        const auto op = decode(chunk, pos);
+        loads += op.code == OpCode::Load ? 1U : 0U;
+        pos += op.size;
+    }
+
+    expect(loads == 2, "load of a slot overwritten with a computed value");
+}
+
+// A chunk file whose index is out of order fails to open, CRC check or not.
+
+inline void testContainer()
+{
+    Chunk_file_writer writer;
+    writer.Add("a", compile(pratt("1")->first));
+    writer.Add("b", compile(pratt("2")->first));
+
+    auto image = writer.Image();
+    const auto index = image.begin() + static_cast<std::ptrdiff_t>((sizeof(Chunk_file_header) + sectionAlignment - 1) / sectionAlignment * sectionAlignment);
+    constexpr auto entry = static_cast<std::ptrdiff_t>(sizeof(Chunk_file_entry));
+    std::swap_ranges(index, index + entry, index + entry);
+
+    const auto path = (std::filesystem::temp_directory_path() / "interpreter-self-test.xbc").string();
+    std::ofstream{path, std::ios::binary} << image;
+
+    try
+    {
+        const Chunk_file file{path};
+        expect(false, "chunk file with an unsorted index opened");
+    }
+    catch(const Chunk_file_error& error)
+    {
+        expect(std::string_view{error.what()}.find("index not sorted") != std::string_view::npos, "unsorted index reported");
+    }
+
+    std::filesystem::remove(path);
+}
+
+// A chunk whose bytecode does not verify fails when it is first returned,
+// not when the file is opened.
+
+inline void testContainerLazy()
+{
+    Chunk_file_writer writer;
+    writer.Add("a", compile(pratt("1 + 2")->first));
+
+    auto image = writer.Image();
+    Chunk_file_entry entry;
+    std::memcpy(&entry, image.data() + (sizeof(Chunk_file_header) + sectionAlignment - 1) / sectionAlignment * sectionAlignment, sizeof(entry));
+    image[entry.code] = static_cast<char>(0xFF);
+
+    const auto path = (std::filesystem::temp_directory_path() / "interpreter-self-test-lazy.xbc").string();
+    std::ofstream{path, std::ios::binary} << image;
+
+    try
+    {
+        const Chunk_file file{path};
+
+        try
+        {
+            file[0];
+            expect(false, "chunk with an invalid opcode returned");
+        }
+        catch(const Chunk_file_error& error)
+        {
+            expect(std::string_view{error.what()}.find("invalid opcode") != std::string_view::npos, "invalid opcode reported");
+        }
+    }
+    catch(const Chunk_file_error&)
+    {
+        expect(false, "chunk file with an invalid chunk failed to open");
+    }
+
+    std::filesystem::remove(path);
+}
+
+// A file shorter than the index offset has no room for an index, whatever
+// its header counts.
+
+inline void testContainerShort()
+{
+    std::string image(40, '\0');
+    const Chunk_file_header header{chunkFileMagic, chunkFileVersion, chunkFileByteOrder, 1, image.size(), 0, 0};
+    std::memcpy(image.data(), &header, sizeof(header));
+
+    const auto path = (std::filesystem::temp_directory_path() / "interpreter-self-test-short.xbc").string();
+    std::ofstream{path, std::ios::binary} << image;
+
+    try
+    {
+        const Chunk_file file{path};
+        expect(false, "40-byte chunk file opened");
+    }
+    catch(const Chunk_file_error& error)
+    {
+        expect(std::string_view{error.what()}.find("index out of bounds") != std::string_view::npos, "40-byte chunk file reported");
+    }
+
+    std::filesystem::remove(path);
+}
+
+// exec verifies chunks it is not told are verified, and the unchecked
+// executors take nothing else.
+
+static_assert(!std::is_constructible_v<Program_t, std::shared_ptr<const Chunk_t>>);
+static_assert(!std::is_constructible_v<Verified_chunk, Chunk_view>);
+static_assert(!std::is_constructible_v<Threaded, Chunk_view>);
+static_assert(!std::is_constructible_v<Jit, Chunk_view>);
+
+inline void testExecVerifies()
+{
+    const std::string code{static_cast<char>(OpCode::Add), static_cast<char>(OpCode::Return)};
+
+    try
+    {
+        exec(Chunk_view{{}, code, 2});
+        expect(false, "exec ran an unverified chunk");
+    }
+    catch(const Bytecode_error&)
+    {
+    }
+
+    const auto chunk = compile(pratt("1 + 2 * 3")->first);
+    expect(exec(chunk) == 7 && exec(verify(chunk)) == 7 && exec(make_program(chunk)) == 7, "exec of a verified chunk");
+
+    try
+    {
+        exec(Program_t{});
+        expect(false, "exec ran an empty program");
+    }
+    catch(const Bytecode_error&)
+    {
+    }
+}
+
+inline auto selfTest() -> std::size_t
+{
+    testRepetition();
+    testDepth();
+    testStatic();
+    testFlat();
+    testPeephole();
+    testContainer();
+    testContainerShort();
+    testContainerLazy();
+    testExecVerifies();
+    testJit();
+
+    return failures();
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "Compiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Threaded interpreter: the chunk is decoded once into cells holding the
+// handler to run and its operand already resolved (pool constants, small
+// integers and slots alike), so dispatch is one indirect jump per cell and
+// nothing is range-checked at run time: it takes verified chunks only.
+// With GCC and Clang the handler is a label address and every handler
+// jumps straight to the next one (computed goto); elsewhere Run() falls
+// back to a switch.
+//
+// A push followed by a binary operator, the most frequent pair in compiled
+// formulas, becomes one PushAdd/PushSub/PushMul/PushDiv superinstruction;
+// AddImm is a PushAdd. The stack is sized when decoding and its top is kept
+// in a local.
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INTERPRETER_COMPUTED_GOTO 1
+#else
+#define INTERPRETER_COMPUTED_GOTO 0
+#endif
+
+class Threaded
+{
+public:
+
+    enum class Handler : std::uint8_t
+    {
+        Push,
+        Neg,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Fma,
+        Store,
+        Load,
+        PushAdd,
+        PushSub,
+        PushMul,
+        PushDiv,
+        Return,
+    };
+
+    static constexpr std::size_t nbHandlers = static_cast<std::size_t>(Handler::Return) + 1;
+
+    explicit Threaded(Verified_chunk verified)
+    {
+        const Chunk_view chunk = verified;
+        std::size_t depth{}, slotCount{};
+
+        const auto append = [&](Handler handler, Data_t value = {}, Slot_t slot = {})
+        {
+            Cell cell{};
+            cell.value = value;
+
+            if(handler == Handler::Store || handler == Handler::Load)
+            {
+                cell.slot = slot;
+                slotCount = std::max<std::size_t>(slotCount, slot + 1U);
+            }
+
+            cells.push_back(cell);
+            handlers.push_back(handler);
+        };
+
+        for(std::size_t pos = 0; pos < chunk.code.size();)
+        {
+            const auto op = decode(chunk, pos);
+            pos += op.size;
+
+            if(is_push(op.code))
+            {
+                const auto next = pos < chunk.code.size() ? static_cast<std::byte>(chunk.code[pos]) : OpCode::NoOp;
+                const auto fused = next == OpCode::Add ? Handler::PushAdd
+                                 : next == OpCode::Sub ? Handler::PushSub
+                                 : next == OpCode::Mul ? Handler::PushMul
+                                 : next == OpCode::Div ? Handler::PushDiv
+                                 : Handler::Push;
+
+                if(fused != Handler::Push)
+                {
+                    pos += instruction_size(next);
+                    ++fusedPairs;
+                }
+                else
+                {
+                    maxDepth = std::max(maxDepth, ++depth);
+                }
+
+                append(fused, op.value);
+            }
+            else if(op.code == OpCode::Load)
+            {
+                maxDepth = std::max(maxDepth, ++depth);
+                append(Handler::Load, {}, op.slot);
+            }
+            else if(op.code == OpCode::Store)
+            {
+                append(Handler::Store, {}, op.slot);
+            }
+            else if(op.code == OpCode::AddImm)
+            {
+                append(Handler::PushAdd, op.value);
+            }
+            else if(op.code == OpCode::Neg)
+            {
+                append(Handler::Neg);
+            }
+            else if(op.code == OpCode::Fma)
+            {
+                depth -= 2;
+                append(Handler::Fma);
+            }
+            else if(op.code == OpCode::Add || op.code == OpCode::Sub || op.code == OpCode::Mul || op.code == OpCode::Div)
+            {
+                depth -= 1;
+                append(op.code == OpCode::Add ? Handler::Add
+                     : op.code == OpCode::Sub ? Handler::Sub
+                     : op.code == OpCode::Mul ? Handler::Mul
+                     : Handler::Div);
+            }
+            else if(op.code == OpCode::Return)
+            {
+                break;
+            }
+        }
+
+        append(Handler::Return);
+
+        // The cached top needs no cell, the first push spills a dummy one.
+        stack.resize(maxDepth + 1);
+        slots.resize(slotCount);
+
+#if INTERPRETER_COMPUTED_GOTO
+        const void* const* table{};
+        Dispatch(nullptr, &table);
+
+        for(std::size_t i = 0; i < cells.size(); ++i)
+        {
+            cells[i].address = table[static_cast<std::size_t>(handlers[i])];
+        }
+#endif
+    }
+
+    // Threaded when the compiler supports it, else the switch loop.
+    auto Run() -> Data_t
+    {
+#if INTERPRETER_COMPUTED_GOTO
+        return Dispatch(this, nullptr);
+#else
+        return RunSwitch();
+#endif
+    }
+
+    auto RunSwitch() -> Data_t
+    {
+        const auto* cell = cells.data();
+        auto* sp = stack.data();
+        Data_t top{};
+
+        for(const auto* handler = handlers.data();; ++handler, ++cell)
+        {
+            switch(*handler)
+            {
+                case Handler::Push: *sp++ = top; top = cell->value; break;
+                case Handler::Neg: top = -top; break;
+                case Handler::Add: top = *--sp + top; break;
+                case Handler::Sub: top = *--sp - top; break;
+                case Handler::Mul: top = *--sp * top; break;
+                case Handler::Div: top = *--sp / top; break;
+                case Handler::Fma: sp -= 2; top = std::fma(sp[0], sp[1], top); break;
+                case Handler::Store: slots[cell->slot] = top; break;
+                case Handler::Load: *sp++ = top; top = slots[cell->slot]; break;
+                case Handler::PushAdd: top += cell->value; break;
+                case Handler::PushSub: top -= cell->value; break;
+                case Handler::PushMul: top *= cell->value; break;
+                case Handler::PushDiv: top /= cell->value; break;
+                case Handler::Return: return top;
+            }
+        }
+    }
+
+    // Cells dispatched per run, and how many push/operator pairs they fused.
+    auto Size() const -> std::size_t
+    {
+        return cells.size();
+    }
+
+    auto FusedPairs() const -> std::size_t
+    {
+        return fusedPairs;
+    }
+
+private:
+
+    struct Cell
+    {
+        const void* address;
+        union
+        {
+            Data_t value;
+            Slot_t slot;
+        };
+    };
+
+#if INTERPRETER_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+    // Runs `self`, or with `table` set, hands out the label addresses so the
+    // constructor can thread the cells.
+    static auto Dispatch(Threaded* self, const void* const** table) -> Data_t
+    {
+        static const void* const labels[nbHandlers]
+        {
+            &&Push, &&Neg, &&Add, &&Sub, &&Mul, &&Div, &&Fma, &&Store, &&Load,
+            &&PushAdd, &&PushSub, &&PushMul, &&PushDiv, &&Return,
+        };
+
+        if(table != nullptr)
+        {
+            *table = labels;
+            return {};
+        }
+
+        const auto* cell = self->cells.data();
+        auto* sp = self->stack.data();
+        auto* const slots = self->slots.data();
+        Data_t top{};
+
+        #define NEXT goto *(++cell)->address
+
+        goto *cell->address;
+
+        Push: *sp++ = top; top = cell->value; NEXT;
+        Neg: top = -top; NEXT;
+        Add: top = *--sp + top; NEXT;
+        Sub: top = *--sp - top; NEXT;
+        Mul: top = *--sp * top; NEXT;
+        Div: top = *--sp / top; NEXT;
+        Fma: sp -= 2; top = std::fma(sp[0], sp[1], top); NEXT;
+        Store: slots[cell->slot] = top; NEXT;
+        Load: *sp++ = top; top = slots[cell->slot]; NEXT;
+        PushAdd: top += cell->value; NEXT;
+        PushSub: top -= cell->value; NEXT;
+        PushMul: top *= cell->value; NEXT;
+        PushDiv: top /= cell->value; NEXT;
+        Return: return top;
+
+        #undef NEXT
+    }
+
+#pragma GCC diagnostic pop
+#endif
+
+    std::vector<Cell> cells;
+    std::vector<Handler> handlers;
+    std::vector<Data_t> stack;
+    std::vector<Data_t> slots;
+    std::size_t maxDepth{};
+    std::size_t fusedPairs{};
+};
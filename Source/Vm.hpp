@@ -2,139 +2,278 @@
 
 #include "Ast.hpp"
 #include "Compiler.hpp"
+#include "Profile.hpp"
 
 #include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstdint>
 #include <functional>
+#include <iostream>
+#include <memory>
 #include <span>
-#include <stack>
+#include <string_view>
+#include <utility>
 #include <variant>
+#include <vector>
 
-auto execute(const Chunk_t& c) -> Data_t
+// Contiguous value stack sized to a chunk's depth: inline up to
+// `inlineDepth` values, one allocation beyond. Nothing is checked, the depth
+// computed by the compiler is trusted. Reset keeps the storage when it is
+// large enough.
+
+class Value_stack
 {
-    std::stack<Data_t> s;
+public:
+
+    static constexpr std::size_t inlineDepth = 32;
+
+    explicit Value_stack(std::size_t depth)
+    {
+        Reset(depth);
+    }
+
+    Value_stack(Value_stack&& other) noexcept
+        : local{other.local}, heap{std::move(other.heap)}, base{heap ? heap.get() : local.data()},
+          capacity{other.capacity}, height{other.height}
+    {
+    }
+
+    Value_stack(const Value_stack&) = delete;
+    auto operator=(const Value_stack&) -> Value_stack& = delete;
+    auto operator=(Value_stack&&) -> Value_stack& = delete;
+    ~Value_stack() = default;
+
+    void Push(Data_t value)
+    {
+        base[height++] = value;
+    }
+
+    auto Pop() -> Data_t
+    {
+        return base[--height];
+    }
+
+    auto Top() const -> Data_t
+    {
+        return base[height - 1];
+    }
+
+    auto Empty() const -> bool
+    {
+        return height == 0;
+    }
 
-    for(const auto& op : c)
+    auto Size() const -> std::size_t
     {
-        std::visit(overloaded
+        return height;
+    }
+
+    void Clear()
+    {
+        height = 0;
+    }
+
+    // Empty, with room for `depth` values.
+    void Reset(std::size_t depth)
+    {
+        if(depth > capacity)
         {
-            [&](OpCodes::Neg)
-            {
-                const auto v  = s.top();
-                s.pop();
-                s.push(-v);
-            },
-            [&](OpCodes::Add)
-            {
-                const auto rhs = s.top();
-                s.pop();
-                const auto lhs = s.top();
-                s.pop();
-                s.push(lhs + rhs);
-            },
-            [&](OpCodes::Sub)
-            {
-                const auto rhs = s.top();
-                s.pop();
-                const auto lhs = s.top();
-                s.pop();
-                s.push(lhs - rhs);
-            },
-            [&](OpCodes::Mul)
-            {
-                const auto rhs = s.top();
-                s.pop();
-                const auto lhs = s.top();
-                s.pop();
-                s.push(lhs * rhs);
-            },
-            [&](OpCodes::Div)
-            {
-                const auto rhs = s.top();
-                s.pop();
-                const auto lhs = s.top();
-                s.pop();
-                s.push(lhs / rhs);
-            },
-            [&](const OpCodes::Push& v)
-            {
-                s.push(v.value);
-            },
-            [&](auto) {},
-        }, op);
+            heap = std::make_unique<Data_t[]>(depth);
+            base = heap.get();
+            capacity = depth;
+        }
+
+        height = 0;
     }
 
-    return s.top();
+    // For executors keeping their own stack pointer.
+    auto Data() -> Data_t*
+    {
+        return base;
+    }
+
+private:
+
+    std::array<Data_t, inlineDepth> local;
+    std::unique_ptr<Data_t[]> heap;
+    Data_t* base{local.data()};
+    std::size_t capacity{inlineDepth};
+    std::size_t height{};
+};
+
+// Reference executor: decodes every instruction, then applies it.
+
+auto execute(Verified_chunk verified) -> Data_t
+{
+    const Chunk_view c = verified;
+    Value_stack s{c.depth};
+    std::vector<Data_t> slots;
+
+    const auto pop = [&] { return s.Pop(); };
+
+    for(std::size_t pos = 0; pos < c.code.size();)
+    {
+        const auto op = decode(c, pos);
+        pos += op.size;
+
+        if(op.code == OpCode::Return)
+        {
+            break;
+        }
+
+        if(op.code == OpCode::Neg)
+        {
+            s.Push(-pop());
+        }
+        else if(op.code == OpCode::Add || op.code == OpCode::Sub || op.code == OpCode::Mul || op.code == OpCode::Div)
+        {
+            const auto rhs = pop();
+            const auto lhs = pop();
+
+            s.Push(op.code == OpCode::Add ? lhs + rhs
+                 : op.code == OpCode::Sub ? lhs - rhs
+                 : op.code == OpCode::Mul ? lhs * rhs
+                 : lhs / rhs);
+        }
+        else if(op.code == OpCode::Store)
+        {
+            slots.resize(std::max<std::size_t>(slots.size(), op.slot + 1));
+            slots[op.slot] = s.Top();
+        }
+        else if(op.code == OpCode::Load)
+        {
+            s.Push(slots[op.slot]);
+        }
+        else if(op.code == OpCode::AddImm)
+        {
+            s.Push(pop() + op.value);
+        }
+        else if(op.code == OpCode::Fma)
+        {
+            const auto addend = pop();
+            const auto rhs = pop();
+            const auto lhs = pop();
+            s.Push(std::fma(lhs, rhs, addend));
+        }
+        else if(is_push(op.code))
+        {
+            s.Push(op.value);
+        }
+    }
+
+    return s.Empty() ? Data_t{} : s.Top();
 }
 
+// What a Vm changes while running: instruction index, stack and slots.
+// Reset keeps their storage, so a context that already ran a program as
+// deep as the next one runs it without allocating.
+
+struct Execution_context
+{
+    std::size_t index{};
+    Value_stack stack{0};
+    std::vector<Data_t> slots;
+
+    void Reset(std::size_t depth)
+    {
+        index = 0;
+        stack.Reset(depth);
+        slots.clear();
+    }
+};
+
 class Vm;
 
 using Instruction_t = std::uint8_t;
 using InstructionPtmf_t = void(Vm::*)();
 
-inline constexpr Instruction_t nbInstructions = 8U;
+inline constexpr Instruction_t nbInstructions = 19U;
+
+// Runs a shared, immutable and verified program in a context of its own:
+// threads each with their own Vm run the same program without copying it,
+// and Load switches a Vm to another program, reusing its context.
 
 class Vm
 {
 public:
 
-    Vm(Chunk_type c) : chunk{c} {}
+    Vm(Chunk_t c) : Vm{make_program(std::move(c))} {}
+
+    explicit Vm(Program_t p)
+    {
+        Load(std::move(p));
+    }
+
+    Vm(Vm&&) noexcept = default;
     Vm() = delete;
     ~Vm() = default;
 
-    void ExecuteInstruction(Instruction_t instruction)
+    void Load(Program_t p)
     {
-        const auto i = std::clamp(instruction, Instruction_t{0}, nbInstructions);
-        std::invoke(instructions[i], this);
+        chunk = Verified_chunk{p};
+        program = std::move(p);
+        context.Reset(chunk.depth);
     }
 
     void Step()
     {
-        if(index >= chunk.size())
+        auto& index = context.index;
+
+        if(index >= chunk.code.size())
         {
             return;
         }
 
-        const auto instruction = static_cast<Instruction_t>(chunk[index++]);
-        ExecuteInstruction(instruction);
+        const auto instruction = static_cast<Instruction_t>(chunk.code[index]);
+
+#if INTERPRETER_PROFILE
+        profiler().Enter(static_cast<std::byte>(instruction), context.stack.Size());
+#endif
+
+        // Programs are verified: every opcode has a handler.
+        std::invoke(instructions[instruction], this);
+        ++index;
     }
 
     auto Execute()
     {
-        for(index = 0; index < chunk.size(); ++index)
+        context.Reset(chunk.depth);
+
+        // Programs are verified: every opcode has a handler and the code
+        // ends with Return, so neither is checked.
+        while(static_cast<std::byte>(chunk.code[context.index]) != OpCode::Return)
         {
-            const auto instruction = static_cast<Instruction_t>(chunk[index]);
-            ExecuteInstruction(instruction);
+#if INTERPRETER_PROFILE
+            profiler().Enter(static_cast<std::byte>(chunk.code[context.index]), context.stack.Size());
+#endif
+
+            std::invoke(instructions[static_cast<Instruction_t>(chunk.code[context.index])], this);
+            ++context.index;
         }
 
-        return stack.top();
+#if INTERPRETER_PROFILE
+        profiler().Enter(OpCode::Return, context.stack.Size());
+        profiler().Exit();
+#endif
+
+        return context.stack.Top();
     }
 
     auto Top() const
     {
-        return stack.top();
+        return context.stack.Top();
     }
 
 private:
 
-    const std::array<InstructionPtmf_t, nbInstructions> instructions
-    {
-        &Vm::NoOp,
-        &Vm::Push,
-        &Vm::Return,
-        &Vm::Neg,
-        &Vm::Add,
-        &Vm::Sub,
-        &Vm::Mul,
-        &Vm::Div,
-    };
+    // One table for every Vm, defined after the class.
+    static const std::array<InstructionPtmf_t, nbInstructions> instructions;
 
     auto pop2()
     {
-        const auto rhs = stack.top();
-        stack.pop();
-        const auto lhs = stack.top();
-        stack.pop();
+        const auto rhs = context.stack.Pop();
+        const auto lhs = context.stack.Pop();
         return std::pair{lhs, rhs};
     }
 
@@ -142,46 +281,95 @@ private:
     {
     }
 
-    void Push()
+    template <typename T>
+    auto Operand() -> T
+    {
+        const auto operand = read_operand<T>(chunk.code.data() + context.index + 1);
+        context.index += sizeof(T);
+        return operand;
+    }
+
+    void PushConst8()
     {
-        Data_t value{};
+        context.stack.Push(chunk.constants[Operand<std::uint8_t>()]);
+    }
+
+    void PushConst16()
+    {
+        context.stack.Push(chunk.constants[Operand<std::uint16_t>()]);
+    }
+
+    void PushConst32()
+    {
+        context.stack.Push(chunk.constants[Operand<std::uint32_t>()]);
+    }
+
+    void PushInt8()
+    {
+        context.stack.Push(Operand<std::int8_t>());
+    }
+
+    void PushInt16()
+    {
+        context.stack.Push(Operand<std::int16_t>());
+    }
+
+    void AddImm()
+    {
+        const auto operand = context.stack.Pop();
+        context.stack.Push(operand + chunk.constants[Operand<std::uint16_t>()]);
+    }
+
+    void Fma()
+    {
+        const auto addend = context.stack.Pop();
+        const auto operands = pop2();
+        context.stack.Push(std::fma(operands.first, operands.second, addend));
+    }
 
-        const std::span view{chunk.data() + index + 1, sizeof(Data_t)};
-        std::copy(view.begin(), view.end(), reinterpret_cast<std::uint8_t*>(&value)); 
+    void PushZero()
+    {
+        context.stack.Push(0.0);
+    }
 
-        index += sizeof(Data_t);
-        stack.push(value);
+    void PushOne()
+    {
+        context.stack.Push(1.0);
+    }
+
+    void PushMinusOne()
+    {
+        context.stack.Push(-1.0);
     }
 
     void Neg()
     {
-        const auto operand = stack.top();
-        stack.pop();
-        stack.push(-operand);
+        const auto operand = context.stack.Pop();
+        context.stack.Push(-operand);
     }
 
     void Add()
     {
         const auto operands = pop2();
-        stack.push(operands.first + operands.second);
+        context.stack.Push(operands.first + operands.second);
     }
 
     void Sub()
     {
         const auto operands = pop2();
-        stack.push(operands.first - operands.second);
+        context.stack.Push(operands.first - operands.second);
     }
 
     void Div()
     {
         const auto operands = pop2();
-        stack.push(operands.first / operands.second);
+        context.stack.Push(operands.first / operands.second);
     }
 
     void Mul()
     {
         const auto operands = pop2();
-        stack.push(operands.first * operands.second);
+        context.stack.Push(operands.first * operands.second);
     }
 
     void Return()
@@ -189,89 +377,242 @@ private:
 
     }
 
-    Chunk_type chunk;
-    std::size_t index{};
-    std::stack<Data_t> stack;
+    void Store()
+    {
+        const auto slot = Operand<Slot_t>();
+
+        if(slot >= context.slots.size())
+        {
+            context.slots.resize(slot + 1);
+        }
+
+        context.slots[slot] = context.stack.Top();
+    }
+
+    void Load()
+    {
+        context.stack.Push(context.slots[Operand<Slot_t>()]);
+    }
+
+    Program_t program;
+    Chunk_view chunk;       // *program
+    Execution_context context;
+};
+
+inline const std::array<InstructionPtmf_t, nbInstructions> Vm::instructions
+{
+    &Vm::NoOp,
+    &Vm::PushConst8,
+    &Vm::Return,
+    &Vm::Neg,
+    &Vm::Add,
+    &Vm::Sub,
+    &Vm::Mul,
+    &Vm::Div,
+    &Vm::Store,
+    &Vm::Load,
+    &Vm::PushConst16,
+    &Vm::PushConst32,
+    &Vm::PushInt8,
+    &Vm::PushZero,
+    &Vm::PushOne,
+    &Vm::PushMinusOne,
+    &Vm::PushInt16,
+    &Vm::AddImm,
+    &Vm::Fma,
 };
 
-auto exec(const Chunk_type& c) -> Data_t
+// The top of the stack lives in a local, `sp` points past the values below
+// it: the first push spills a dummy value, hence one more cell than the
+// chunk's depth. Unchecked, hence verified chunks only: it runs until Return.
+
+auto exec(Verified_chunk verified) -> Data_t
 {
-    std::stack<Data_t> stack;
+    const Chunk_view c = verified;
+    Value_stack stack{c.depth + 1};
+    std::vector<Data_t> slots;
+
+    const auto* const code = c.code.data();
+    auto* sp = stack.Data();
+    Data_t top{};
 
-    // std::cout << "size = " << sz << std::endl;
-    const auto pop2 = [&]
+    const auto push = [&](Data_t value)
     {
-        const auto rhs = stack.top();
-        stack.pop();
-        const auto lhs = stack.top();
-        stack.pop();
-        return std::pair{lhs, rhs};
+        *sp++ = top;
+        top = value;
     };
 
-    for(std::size_t pos = 0; pos < c.size(); ++pos)
+    for(std::size_t pos = 0;; ++pos)
     {
-        const auto code = static_cast<std::byte>(c[pos]);
+        const auto op = static_cast<std::byte>(code[pos]);
+
+#if INTERPRETER_PROFILE
+        profiler().Enter(op, static_cast<std::size_t>(sp - stack.Data()));
+#endif
 
-        switch(code)
+        switch(op)
         {
-            case OpCode::Push:
-            {                
-                double value{};
+            case OpCode::PushConst8:
+            {
+                push(c.constants[read_operand<std::uint8_t>(code + pos + 1)]);
+                pos += sizeof(std::uint8_t);
+                break;
+            }
 
-                const std::span view{c.data() + pos + 1, sizeof(Data_t)};
-                std::copy(view.begin(), view.end(), reinterpret_cast<std::uint8_t*>(&value)); 
+            case OpCode::PushConst16:
+            {
+                push(c.constants[read_operand<std::uint16_t>(code + pos + 1)]);
+                pos += sizeof(std::uint16_t);
+                break;
+            }
 
-                pos += sizeof(Data_t);
-                stack.push(value);
+            case OpCode::PushConst32:
+            {
+                push(c.constants[read_operand<std::uint32_t>(code + pos + 1)]);
+                pos += sizeof(std::uint32_t);
                 break;
             }
 
-            case OpCode::Neg:
+            case OpCode::PushInt8:
             {
-                const auto operand = stack.top();
-                stack.pop();
-                stack.push(-operand);
+                push(read_operand<std::int8_t>(code + pos + 1));
+                pos += sizeof(std::int8_t);
                 break;
             }
 
-            case OpCode::Add:
+            case OpCode::PushInt16:
             {
-                const auto operands = pop2();
-                stack.push(operands.first + operands.second);
+                push(read_operand<std::int16_t>(code + pos + 1));
+                pos += sizeof(std::int16_t);
                 break;
             }
 
-            case OpCode::Sub:
+            case OpCode::AddImm:
             {
-                const auto operands = pop2();
-                stack.push(operands.first - operands.second);
+                top += c.constants[read_operand<std::uint16_t>(code + pos + 1)];
+                pos += sizeof(std::uint16_t);
                 break;
             }
 
-            case OpCode::Div:
+            case OpCode::Fma:
             {
-                const auto operands = pop2();
-                stack.push(operands.first / operands.second);
+                const auto rhs = *--sp;
+                const auto lhs = *--sp;
+                top = std::fma(lhs, rhs, top);
                 break;
             }
 
-            case OpCode::Mul:
+            case OpCode::PushZero: push(0.0); break;
+            case OpCode::PushOne: push(1.0); break;
+            case OpCode::PushMinusOne: push(-1.0); break;
+
+            case OpCode::Neg: top = -top; break;
+            case OpCode::Add: top = *--sp + top; break;
+            case OpCode::Sub: top = *--sp - top; break;
+            case OpCode::Div: top = *--sp / top; break;
+            case OpCode::Mul: top = *--sp * top; break;
+
+            case OpCode::Store:
             {
+                const auto s = read_operand<Slot_t>(code + pos + 1);
 
-                const auto operands = pop2();
-                stack.push(operands.first * operands.second);
+                if(s >= slots.size())
+                {
+                    slots.resize(s + 1);
+                }
+
+                slots[s] = top;
+                pos += sizeof(Slot_t);
+                break;
+            }
+
+            case OpCode::Load:
+            {
+                push(slots[read_operand<Slot_t>(code + pos + 1)]);
+                pos += sizeof(Slot_t);
                 break;
             }
 
-            case OpCode::Return: return stack.top();
+            case OpCode::Return:
+            {
+#if INTERPRETER_PROFILE
+                profiler().Exit();
+#endif
+                return top;
+            }
+
             default:break;
         }
     }
+}
 
-    return {};
+auto exec(const Program_t& program) -> Data_t
+{
+    return exec(Verified_chunk{program});
 }
 
-auto debug(const Chunk_t& c)
+// A chunk from anywhere else is verified on every run.
+
+auto exec(Chunk_view c) -> Data_t
+{
+    return exec(verify(c));
+}
+
+// Register machine for Reg_chunk_t: one dispatch per operator, operands
+// read straight from the register file or the pool.
+
+class RegVm
+{
+public:
+
+    explicit RegVm(Reg_chunk_t c) : chunk{std::move(c)}, registers(chunk.registers) {}
+
+    auto Execute() -> Data_t
+    {
+        auto* const r = registers.data();
+        const auto* const k = chunk.constants.data();
+
+        for(const auto& i : chunk.code)
+        {
+            switch(i.op)
+            {
+                case Reg_op::AddRR: r[i.dst] = r[i.a] + r[i.b]; break;
+                case Reg_op::AddRK: r[i.dst] = r[i.a] + k[i.b]; break;
+                case Reg_op::AddKR: r[i.dst] = k[i.a] + r[i.b]; break;
+                case Reg_op::AddKK: r[i.dst] = k[i.a] + k[i.b]; break;
+                case Reg_op::SubRR: r[i.dst] = r[i.a] - r[i.b]; break;
+                case Reg_op::SubRK: r[i.dst] = r[i.a] - k[i.b]; break;
+                case Reg_op::SubKR: r[i.dst] = k[i.a] - r[i.b]; break;
+                case Reg_op::SubKK: r[i.dst] = k[i.a] - k[i.b]; break;
+                case Reg_op::MulRR: r[i.dst] = r[i.a] * r[i.b]; break;
+                case Reg_op::MulRK: r[i.dst] = r[i.a] * k[i.b]; break;
+                case Reg_op::MulKR: r[i.dst] = k[i.a] * r[i.b]; break;
+                case Reg_op::MulKK: r[i.dst] = k[i.a] * k[i.b]; break;
+                case Reg_op::DivRR: r[i.dst] = r[i.a] / r[i.b]; break;
+                case Reg_op::DivRK: r[i.dst] = r[i.a] / k[i.b]; break;
+                case Reg_op::DivKR: r[i.dst] = k[i.a] / r[i.b]; break;
+                case Reg_op::DivKK: r[i.dst] = k[i.a] / k[i.b]; break;
+                case Reg_op::Neg: r[i.dst] = -r[i.a]; break;
+                case Reg_op::LoadK: r[i.dst] = k[i.a]; break;
+                case Reg_op::Return: return r[i.a];
+            }
+        }
+
+        return {};
+    }
+
+    auto Size() const -> std::size_t
+    {
+        return chunk.code.size();
+    }
+
+private:
+
+    Reg_chunk_t chunk;
+    std::vector<Data_t> registers;
+};
+
+auto debug(Chunk_view c)
 {
 
     std::cout << "┌────────────────┐" << std::endl;
@@ -281,19 +622,38 @@ auto debug(const Chunk_t& c)
 
     std::cout << "┌────────────────┐" << std::endl;
 
-    for(const auto& op : c)
+    for(std::size_t pos = 0; pos < c.code.size();)
     {
-        std::visit(overloaded
+        const auto op = decode(c, pos);
+        pos += op.size;
+
+        switch(op.code)
         {
-            [&](OpCodes::Neg) { std::cout << "│➖ Negate       │   " << std::endl; },
-            [&](OpCodes::Add) { std::cout << "│➕ Add          │   " << std::endl; },
-            [&](OpCodes::Sub) { std::cout << "│➖ Subtract     │   " << std::endl; },
-            [&](OpCodes::Mul) { std::cout << "│ ✖ Multiply     │   " << std::endl; },
-            [&](OpCodes::Div) { std::cout << "│➗ Divide       │   " << std::endl; },
-            [&](const OpCodes::Push& v) { std::cout << "│📌 Push         │ 💾 " << v.value << std::endl; },
-            [&](auto) {},
-        }, op);
+            case OpCode::Neg: std::cout << "│➖ Negate       │   " << std::endl; break;
+            case OpCode::Add: std::cout << "│➕ Add          │   " << std::endl; break;
+            case OpCode::Sub: std::cout << "│➖ Subtract     │   " << std::endl; break;
+            case OpCode::Mul: std::cout << "│ ✖ Multiply     │   " << std::endl; break;
+            case OpCode::Div: std::cout << "│➗ Divide       │   " << std::endl; break;
+            case OpCode::PushConst8:
+            case OpCode::PushConst16:
+            case OpCode::PushConst32: std::cout << "│📌 Push const   │ 💾 " << op.value << std::endl; break;
+            case OpCode::PushInt8: std::cout << "│📌 Push int8    │ 💾 " << op.value << std::endl; break;
+            case OpCode::PushInt16: std::cout << "│📌 Push int16   │ 💾 " << op.value << std::endl; break;
+            case OpCode::PushZero:
+            case OpCode::PushOne:
+            case OpCode::PushMinusOne: std::cout << "│📌 Push         │ 💾 " << op.value << std::endl; break;
+            case OpCode::AddImm: std::cout << "│➕ Add imm      │ 💾 " << op.value << std::endl; break;
+            case OpCode::Fma: std::cout << "│🔀 Fma          │   " << std::endl; break;
+            case OpCode::Store: std::cout << "│📥 Store        │ 🎰 " << op.slot << std::endl; break;
+            case OpCode::Load: std::cout << "│📤 Load         │ 🎰 " << op.slot << std::endl; break;
+            default: break;
+        }
     }
 
     std::cout << "└────────────────┘" << std::endl;
+
+    if(!c.constants.empty())
+    {
+        std::cout << "💾 " << c.constants.size() << " constants, " << c.code.size() << " bytes of code" << std::endl;
+    }
 }
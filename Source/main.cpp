@@ -1,109 +1,196 @@
+#include "Batch.hpp"
+#include "Benchmark.hpp"
+#include "Cache.hpp"
+#include "Closure.hpp"
+#include "Container.hpp"
+#include "Eval.hpp"
+#include "Jit.hpp"
 #include "Parser.hpp"
+#include "Peephole.hpp"
+#include "Rebalance.hpp"
+#include "SelfTest.hpp"
+#include "Threaded.hpp"
 #include "Vm.hpp"
 
-#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <charconv>
 #include <chrono>
 #include <numeric>
+#include <optional>
 #include <ranges>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <vector>
 
-auto eval(const auto& ast) -> Data_t
+// The chunk of `tree` after the peephole `passes` of -O.
+
+auto compileWith(const Expr& tree, unsigned passes) -> Chunk_t
 {
-            // <Data_t, Add, Sub, Mul, Div, Neg>
-    return std::visit(overloaded
-            {
-                [](Data_t value) { return value; },
-                [](const Neg& n) { return -eval(*n.expr); },
-                [](const Mul& m) { return eval(*m.lhs) * eval(*m.rhs); },
-                [](const Div& m) { return eval(*m.lhs) / eval(*m.rhs); },
-                [](const Add& m) { return eval(*m.lhs) + eval(*m.rhs); },
-                [](const Sub& m) { return eval(*m.lhs) - eval(*m.rhs); },
-            }, ast);
+    auto chunk = compile(tree);
+    return passes == 0 ? chunk : optimize(chunk, passes);
 }
 
-auto getDepth(const auto& ast, std::size_t depth = 0) -> std::size_t
+// 📦 Evaluates every expression of a file, one result per line. With a
+// library path, also compiles them into a chunk file named by their text.
+// With a cache, expressions are compiled once and their chunks run by `run`.
+// Chunks, cached, written or run by `evaluate`, get the peephole `passes`.
+
+auto runBatch(const std::string& inputPath, const std::optional<std::string>& outputPath, auto parse, auto evaluate, bool isRelaxed,
+              unsigned passes, const std::optional<std::string>& libraryPath, Program_cache* cache, auto run) -> int
 {
-            // <Data_t, Add, Sub, Mul, Div, Neg>
-    return std::visit(overloaded
+    try
+    {
+        Mapped_file input{inputPath};
+        Chunk_file_writer library;
+        std::optional<Buffered_writer> output;
+
+        if(outputPath)
+        {
+            output.emplace(*outputPath);
+        }
+        else
+        {
+            output.emplace(STDOUT_FILENO);
+        }
+
+        constexpr std::string_view spaces{" \t\r\v\f"};
+
+        // The tree of `source`, nothing unless it parses up to trailing spaces.
+        const auto tree = [&](std::string_view source) -> std::optional<Expr>
+        {
+            const auto parsed = parse(source);
+
+            if(!parsed || parsed->second.find_first_not_of(spaces) != std::string_view::npos)
+            {
+                return {};
+            }
+
+            return isRelaxed ? rebalance(parsed->first) : parsed->first;
+        };
+
+        const auto name = [&](std::string_view in)
+        {
+            const auto first = in.find_first_not_of(spaces);
+            return std::string{in.substr(first, in.find_last_not_of(spaces) + 1 - first)};
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+
+        const auto stats = run_batch(input, *output, [&](std::string_view in) -> std::optional<Data_t>
+        {
+            try
+            {
+                if(cache != nullptr)
+                {
+                    const auto program = cache->Get(in, [&](std::string_view source) -> std::optional<Chunk_t>
+                    {
+                        const auto ast = tree(source);
+                        return ast ? std::optional{compileWith(*ast, passes)} : std::nullopt;
+                    });
+
+                    if(!program)
+                    {
+                        return {};
+                    }
+
+                    if(libraryPath)
+                    {
+                        library.Add(name(in), *program);
+                    }
+
+                    return run(program);
+                }
+
+                const auto ast = tree(in);
+
+                if(!ast)
+                {
+                    return {};
+                }
+
+                if(libraryPath)
+                {
+                    library.Add(name(in), compileWith(*ast, passes));
+                }
+
+                return evaluate(*ast, passes);
+            }
+            catch(const Depth_error&)
             {
-                [&](Data_t) { return depth; },
-                [&](const Neg& n) { depth = getDepth(*n.expr, depth + 1); return depth; },
-                [&](const Mul& m) { depth = std::max(getDepth(*m.lhs, depth + 1), getDepth(*m.rhs, depth + 1)); return depth; },
-                [&](const Div& m) { depth = std::max(getDepth(*m.lhs, depth + 1), getDepth(*m.rhs, depth + 1)); return depth; },
-                [&](const Add& m) { depth = std::max(getDepth(*m.lhs, depth + 1), getDepth(*m.rhs, depth + 1)); return depth; },
-                [&](const Sub& m) { depth = std::max(getDepth(*m.lhs, depth + 1), getDepth(*m.rhs, depth + 1)); return depth; },
-            }, ast);
+                return {};
+            }
+        });
+
+        const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cerr << "📦 " << stats.expressions << " expressions, " << stats.errors << " errors, " 
+                  << static_cast<double>(stats.bytes) / seconds / 1e6 << " MB/s" << std::endl;
+
+        if(cache != nullptr)
+        {
+            const auto cached = cache->Stats();
+            std::cerr << "🗃️  " << cached.hits << " hits, " << cached.misses << " misses, " << cached.evictions << " evictions, "
+                      << cached.size << " programs" << std::endl;
+        }
+
+        if(libraryPath)
+        {
+            library.Write(*libraryPath);
+            std::cerr << "📚 " << library.Size() << " chunks written to " << *libraryPath << std::endl;
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "😟 Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
 }
 
-void print(const Expr& ast, std::string prefix = "", bool isLeft = false)
+// 📚 Runs every chunk of a chunk file in place, one result per line.
+
+auto runLibrary(const std::string& libraryPath, const std::optional<std::string>& outputPath) -> int
 {
-    struct ExprFmt
-    {
-        Expr e;
-        std::string prefix;
-        bool isNodeLeft;
-        bool isLeft;   
-    };
-    
-    const auto printNodes = [](const auto&... ef) 
+    try
     {
-        (print(ef.e, ef.prefix + (ef.isNodeLeft ? "│   " : "    "), ef.isLeft), ...);
-    };
+        const auto start = std::chrono::steady_clock::now();
+        const Chunk_file library{libraryPath};
+        const auto opened = std::chrono::steady_clock::now();
 
-    const auto printNode = [](const std::string& prefix, const std::string& symbol, bool isLeft)
-    {
-        std::cout << prefix;
-        std::cout << (isLeft ? "├──" : "└──" );
-        std::cout << symbol << std::endl;
-    };
+        std::optional<Buffered_writer> output;
+
+        if(outputPath)
+        {
+            output.emplace(*outputPath);
+        }
+        else
+        {
+            output.emplace(STDOUT_FILENO);
+        }
+
+        for(std::size_t i = 0; i < library.Size(); ++i)
+        {
+            output->Write(exec(library[i]));
+            output->Write("\n");
+        }
+
+        output->Flush();
+
+        const auto milliseconds = [](auto duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
 
-    const auto printLeaf = [](const std::string& prefix, bool isLeft, const auto& value)
+        std::cerr << "📚 " << library.Size() << " chunks, opened in " << milliseconds(opened - start) << " ms, ran in "
+                  << milliseconds(std::chrono::steady_clock::now() - opened) << " ms" << std::endl;
+    }
+    catch(const std::exception& e)
     {
-        std::cout << prefix << (isLeft ? "├──🍁 " : "└──🍁 " ) << value << std::endl;
-    };
+        std::cerr << "😟 Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    // <Data_t, Add, Sub, Mul, Div, Neg>
-    std::visit(overloaded
-    {
-        [&](Data_t value) 
-        { 
-            printLeaf(prefix, isLeft, value);
-        },
-        [&](const Neg& n) 
-        {
-            printNode(prefix, "➖", isLeft);
-            printNodes(ExprFmt{*n.expr, prefix, isLeft, false});
-        },
-        [&](const Mul& m) 
-        {
-            printNode(prefix, "✖", isLeft);
-            printNodes(ExprFmt{*m.lhs, prefix, isLeft, true}, 
-                       ExprFmt{*m.rhs, prefix, isLeft, false});
-        },
-        [&](const Div& m) 
-        {
-            printNode(prefix, "➗", isLeft);
-            printNodes(ExprFmt{*m.lhs, prefix, isLeft, true}, 
-                       ExprFmt{*m.rhs, prefix, isLeft, false});
-        },
-        [&](const Add& m) 
-        {
-            printNode(prefix, "➕", isLeft);
-            printNodes(ExprFmt{*m.lhs, prefix, isLeft, true}, 
-                       ExprFmt{*m.rhs, prefix, isLeft, false});
-        },
-        [&](const Sub& m) 
-        {
-            printNode(prefix, "➖", isLeft);
-            printNodes(ExprFmt{*m.lhs, prefix, isLeft, true}, 
-                       ExprFmt{*m.rhs, prefix, isLeft, false});
-        },
-        [](auto ){}
-    }, ast);
+    return EXIT_SUCCESS;
 }
 
 int main(int argc, char** argv)
@@ -112,13 +199,136 @@ int main(int argc, char** argv)
     const auto args = std::vector<std::string_view>(argv, argv + argc);
 
     const auto isDebug = std::ranges::find(args, "-d") != args.end();
+    const auto isPratt = std::ranges::find(args, "-p") != args.end();
+    const auto isPackrat = std::ranges::find(args, "-m") != args.end();
+    const auto isFlat = std::ranges::find(args, "-t") != args.end();
+    const auto isCse = std::ranges::find(args, "-c") != args.end();
+    const auto isRelaxed = std::ranges::find(args, "-r") != args.end();    // reassociate: relaxed FP
+
+    // -O0 … -O3: peephole passes on the bytecode.
+    const auto level = [&]
+    {
+        const auto it = std::ranges::find_if(args, [](std::string_view a) { return a.size() == 3 && a.starts_with("-O") && a[2] >= '0' && a[2] <= '3'; });
+        return it == args.end() ? std::size_t{0} : static_cast<std::size_t>((*it)[2] - '0');
+    }();
+
+    const auto passes = optimizationLevels[level];
+
+    const auto option = [&](std::string_view name) -> std::optional<std::string>
+    {
+        const auto it = std::ranges::find(args, name);
+
+        if(it == args.end() || std::next(it) == args.end())
+        {
+            return {};
+        }
+
+        return std::string{*std::next(it)};
+    };
+
+    if(std::ranges::find(args, "-b") != args.end())
+    {
+        return benchmark() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // -s: correctness checks only.
+    if(std::ranges::find(args, "-s") != args.end())
+    {
+        const auto failed = selfTest();
+        std::cerr << (failed == 0 ? "✅ all checks passed" : "😟 " + std::to_string(failed) + " checks failed") << std::endl;
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    using Front_end_t = auto (*)(std::string_view) -> Parsed;
+
+    const Front_end_t parse = isPratt ? Front_end_t{pratt} 
+                            : isPackrat ? [](std::string_view in) { return packrat(in); } 
+                            : expression;
+
+    // -e: engine evaluating batch expressions, given the passes of -O.
+    using Engine_t = auto (*)(const Expr&, unsigned) -> Data_t;
+
+    constexpr std::pair<std::string_view, Engine_t> engines[]
+    {
+        {"tree", [](const Expr& e, unsigned) { return eval(e); }},
+        {"closure", [](const Expr& e, unsigned) { return Closure{e}.Run(); }},
+        {"vm", [](const Expr& e, unsigned levelPasses) { return exec(compileWith(e, levelPasses)); }},
+        {"register", [](const Expr& e, unsigned) { return RegVm{compile_registers(e)}.Execute(); }},
+        {"threaded", [](const Expr& e, unsigned levelPasses) { return Threaded{verify(compileWith(e, levelPasses))}.Run(); }},
+        {"jit", [](const Expr& e, unsigned levelPasses) { return Jit{verify(compileWith(e, levelPasses))}.Run(); }},
+    };
+
+    // The engines of -e that run cached chunks, with -k.
+    using Chunk_engine_t = auto (*)(const Program_t&) -> Data_t;
+
+    constexpr std::pair<std::string_view, Chunk_engine_t> chunkEngines[]
+    {
+        {"vm", [](const Program_t& p) { return exec(p); }},
+        {"threaded", [](const Program_t& p) { return Threaded{Verified_chunk{p}}.Run(); }},
+        {"jit", [](const Program_t& p) { return Jit{Verified_chunk{p}}.Run(); }},
+    };
+
+    const auto capacity = option("-k");
+    const auto engineName = option("-e").value_or(capacity ? "vm" : "tree");
+    const auto engine = std::ranges::find(engines, std::string_view{engineName}, &std::pair<std::string_view, Engine_t>::first);
+    const auto chunkEngine = std::ranges::find(chunkEngines, std::string_view{engineName}, &std::pair<std::string_view, Chunk_engine_t>::first);
+
+    if(engine == std::end(engines))
+    {
+        std::cerr << "😟 Error: unknown engine " << engineName << ", expected tree, closure, vm, register, threaded or jit." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if(capacity && chunkEngine == std::end(chunkEngines))
+    {
+        std::cerr << "😟 Error: engine " << engineName << " cannot run cached programs, expected vm, threaded or jit." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // -k <capacity>: cache compiled programs.
+    std::size_t cacheCapacity{};
+
+    if(capacity)
+    {
+        const auto* last = capacity->data() + capacity->size();
+        const auto [ptr, ec] = std::from_chars(capacity->data(), last, cacheCapacity);
+
+        if(ec != std::errc{} || ptr != last || cacheCapacity == 0)
+        {
+            std::cerr << "😟 Error: invalid cache capacity " << *capacity << ", expected a positive number." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(const auto batch = option("-f"))
+    {
+        std::optional<Program_cache> cache;
+
+        if(capacity)
+        {
+            cache.emplace(cacheCapacity);
+        }
+
+        return runBatch(*batch, option("-o"), parse, engine->second, isRelaxed, passes, option("-w"), cache ? &*cache : nullptr,
+                        capacity ? chunkEngine->second : chunkEngines[0].second);
+    }
+
+    if(const auto library = option("-l"))
+    {
+        return runLibrary(*library, option("-o"));
+    }
 
     for(;;)
     {
         std::cout << "📝  ";
 
         std::string line;
-        std::getline(std::cin, line);
+
+        if(!std::getline(std::cin, line))
+        {
+            return EXIT_SUCCESS;
+        }
+
         const auto input = std::string_view{line};
 
         if(input == "q")
@@ -127,7 +337,17 @@ int main(int argc, char** argv)
             return EXIT_SUCCESS;
         }
 
-        const auto parsed = expression(input);  // 🌳
+        Parsed parsed;
+
+        try
+        {
+            parsed = parse(input);              // 🌳
+        }
+        catch(const Depth_error& e)
+        {
+            std::cout << "😟 Error: " << e.what() << "." << std::endl;
+            continue;
+        }
 
         if(!parsed)
         {
@@ -135,40 +355,98 @@ int main(int argc, char** argv)
             continue;
         }
 
-        const auto bytecode = _compile(parsed->first);   // 💻
+        if(isRelaxed)
+        {
+            parsed->first = rebalance(parsed->first);  // ⚖️
+        }
 
-        const auto bc = compile(parsed->first);
+        Peephole_stats peephole;
+        Program_t program;
+
+        try
+        {
+            program = make_program(optimize(compile(parsed->first), passes, &peephole));   // 💻
+        }
+        catch(const Bytecode_error& e)
+        {
+            std::cout << "😟 Error: " << e.what() << "." << std::endl;
+            continue;
+        }
+
+        const auto& bc = *program;
+        const Verified_chunk verified{program};
+
+        if(level > 0)
+        {
+            std::cout << "⚙️  -O" << level << ": " << peephole.before << " → " << peephole.after << " instructions" << std::endl;
+        }
         // std::cout << bc << std::endl;
 
-        Vm vm{bc};
+        Vm vm{program};
 
         const auto res = vm.Execute();
         std::cout << "res = " << res << std::endl;
 
-        std::ofstream out{"out.hex", std::ofstream::binary};
-        out << bc;
-
-        std::ifstream file{"in.hex", std::ifstream::binary};
-        std::string bytec;
+        std::cout << "result = " << exec(verified) << std::endl;
 
-        file >> bytec;
+        try
+        {
+            Chunk_file_writer library;
+            library.Add(line, bc);
+            library.Write("out.xbc");
 
-        std::cout << "result = " << exec(bc) << std::endl;
-        std::cout << "result [file] = " << exec(bytec) << std::endl;
+            const Chunk_file file{"out.xbc"};
+            std::cout << "result [file] = " << exec(*file.Find(line)) << std::endl;
+        }
+        catch(const std::exception& e)
+        {
+            std::cout << "😟 Error: " << e.what() << "." << std::endl;
+        }
 
         const auto astResult = eval(parsed->first);     // 🌳
         std::cout << "🌳 " << astResult << std::endl;
+        std::cout << "🔗 " << Closure{parsed->first}.Run() << std::endl;
 
-        const auto result = execute(bytecode);          // 💻
+        const auto result = execute(verified);          // 💻
         std::cout << "💻 " << result << std::endl;
 
+        std::cout << "🧵 " << Threaded{verified}.Run() << std::endl;
+
+        Jit jit{verified};
+        std::cout << (jit.IsNative() ? "⚡ " : "⚡🧵 ") << jit.Run() << std::endl;
+
+        Flat_ast flat;
+
+        if(isFlat)
+        {
+            flatten(parsed->first, flat);
+            std::cout << "🧱 " << eval(flat) << std::endl;
+            std::cout << "🧱💻 " << exec(compile(flat)) << std::endl;
+        }
+
+        if(isCse)
+        {
+            Flat_ast dag;
+            Hash_consing consing{dag};
+            flatten(parsed->first, consing);
+
+            const auto shared = optimize(compile_cse(dag), passes);
+            std::cout << "♻️  " << exec(shared) << " (" << consing.Requested() << " → " << dag.Size() << " nodes, "
+                      << count_instructions(bc.code) << " → " << count_instructions(shared.code) << " instructions)" << std::endl;
+        }
+
 
         if(isDebug)
         {
             // const auto d = getDepth(parsed->first);
             // std::cout << "↧ " << d << std::endl;
             print(parsed->first);                       // 🐞🌳
-            debug(bytecode);                            // 🐞
+
+            if(isFlat)
+            {
+                print(flat);                            // 🐞🧱
+            }
+            debug(bc);                                  // 🐞
         }
 
         if(!parsed->second.empty())